@@ -0,0 +1,389 @@
+//
+//  CodeCache.cpp
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+
+#include "CodeCache.h"
+
+#include <string.h>
+
+namespace
+{
+    // Opcode at the given address, Nop for anything outside the instruction set, or -1 past the end of memory
+    int32_t GetOpcode( const int32_t* memory, int32_t address )
+    {
+        if( address >= cMemorySize )
+        {
+            return -1;
+        }
+        return ( uint32_t( memory[ address ] ) < uint32_t( cInstructionCount ) ) ? memory[ address ] : int32_t( cInstruction_Nop );
+    }
+    
+    // Words taken by an instruction, including its arguments
+    int32_t GetInstructionLength( int32_t opcode )
+    {
+        switch( opcode )
+        {
+            case cInstruction_Board: return 3;
+            case cInstruction_SetA: case cInstruction_SetB: case cInstruction_IfJmp: case cInstruction_Jmp: return 2;
+            default: return 1;
+        }
+    }
+    
+    bool IsCompare( int32_t opcode )
+    {
+        return opcode >= cInstruction_Equal && opcode <= cInstruction_GTE;
+    }
+    
+    // Instructions that end a block: control flow or movement
+    bool IsBlockEnd( int32_t opcode )
+    {
+        return opcode == cInstruction_IfJmp || opcode == cInstruction_Jmp ||
+               ( opcode >= cInstruction_GoUp && opcode <= cInstruction_GoRight );
+    }
+    
+    void MarkBitmap( uint64_t* bitmap, int32_t address )
+    {
+        bitmap[ address >> 6 ] |= uint64_t( 1 ) << ( address & 63 );
+    }
+    
+    // Bits [begin & 63, end & 63) of one bitmap word, with end in the same word or right after it
+    uint64_t GetBitRange( int32_t begin, int32_t end )
+    {
+        const uint64_t fromBegin = ~uint64_t( 0 ) << ( begin & 63 );
+        const uint64_t beforeEnd = ( ( end & 63 ) == 0 || ( end >> 6 ) != ( begin >> 6 ) ) ? ~uint64_t( 0 ) : ~( ~uint64_t( 0 ) << ( end & 63 ) );
+        return fromBegin & beforeEnd;
+    }
+    
+    // Marks [begin, end) a bitmap word at a time
+    void MarkBitmapRange( uint64_t* bitmap, int32_t begin, int32_t end )
+    {
+        while( begin < end )
+        {
+            const int32_t wordEnd = std::min( ( begin | 63 ) + 1, end );
+            bitmap[ begin >> 6 ] |= GetBitRange( begin, wordEnd );
+            begin = wordEnd;
+        }
+    }
+    
+    // First marked address in [begin, end), or end if there is none
+    int32_t FindMarked( const uint64_t* bitmap, int32_t begin, int32_t end )
+    {
+        while( begin < end )
+        {
+            const int32_t wordEnd = std::min( ( begin | 63 ) + 1, end );
+            const uint64_t bits = bitmap[ begin >> 6 ] & GetBitRange( begin, wordEnd );
+            if( bits != 0 )
+            {
+                return ( begin & ~63 ) + __builtin_ctzll( bits );
+            }
+            begin = wordEnd;
+        }
+        return end;
+    }
+    
+    // Zeroes the bitmap words spanning [begin, end), then resets the range to empty
+    void ClearBitmap( uint64_t* bitmap, int32_t& begin, int32_t& end )
+    {
+        if( begin < end )
+        {
+            const int32_t firstWord = begin >> 6;
+            const int32_t lastWord = ( end - 1 ) >> 6;
+            memset( (void*)( bitmap + firstWord ), 0, sizeof( uint64_t ) * ( lastWord - firstWord + 1 ) );
+        }
+        begin = cMemorySize;
+        end = 0;
+    }
+}
+
+CodeCache::CodeCache()
+    : m_blockLookup( NULL )
+    , m_coverage( NULL )
+    , m_coverageBegin( cMemorySize )
+    , m_coverageEnd( 0 )
+    , m_volatile( NULL )
+    , m_volatileBegin( cMemorySize )
+    , m_volatileEnd( 0 )
+    , m_instructionWords( NULL )
+    , m_builtWords( NULL )
+{
+    m_blockLookup = new int32_t[ cBlockLookupSize ];
+    memset( (void*)m_blockLookup, 0, sizeof( int32_t ) * cBlockLookupSize );
+    
+    m_coverage = new uint64_t[ cMemorySize / 64 ];
+    memset( (void*)m_coverage, 0, sizeof( uint64_t ) * ( cMemorySize / 64 ) );
+    
+    m_volatile = new uint64_t[ cMemorySize / 64 ];
+    memset( (void*)m_volatile, 0, sizeof( uint64_t ) * ( cMemorySize / 64 ) );
+    
+    // Filled in by FindInstruction()
+    m_instructionWords = new uint64_t[ cMemorySize / 64 ];
+    m_builtWords = new uint64_t[ cMemorySize / 64 / 64 ];
+    memset( (void*)m_builtWords, 0, sizeof( uint64_t ) * ( cMemorySize / 64 / 64 ) );
+}
+
+CodeCache::~CodeCache()
+{
+    delete[] m_blockLookup;
+    delete[] m_coverage;
+    delete[] m_volatile;
+    delete[] m_instructionWords;
+    delete[] m_builtWords;
+}
+
+void CodeCache::Clear()
+{
+    memset( (void*)m_blockLookup, 0, sizeof( int32_t ) * cBlockLookupSize );
+    m_blocks.clear();
+    m_ops.clear();
+    m_nativeCode.Clear();
+    
+    // Only the words that were ever marked need resetting
+    ClearBitmap( m_coverage, m_coverageBegin, m_coverageEnd );
+    ClearBitmap( m_volatile, m_volatileBegin, m_volatileEnd );
+}
+
+void CodeCache::Reset()
+{
+    Clear();
+    memset( (void*)m_builtWords, 0, sizeof( uint64_t ) * ( cMemorySize / 64 / 64 ) );
+}
+
+bool CodeCache::IsVolatile( int32_t address, int32_t length ) const
+{
+    if( address >= m_volatileEnd || address + length <= m_volatileBegin )
+    {
+        return false;
+    }
+    
+    for( int32_t i = address; i < std::min( address + length, cMemorySize ); i++ )
+    {
+        if( IsMarked( m_volatile, i ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int32_t CodeCache::FindInstruction( const int32_t* memory, int32_t address, int32_t end )
+{
+    while( address < end )
+    {
+        const int32_t wordIndex = address >> 6;
+        if( !IsMarked( m_builtWords, wordIndex ) )
+        {
+            uint64_t bits = 0;
+            for( int32_t i = 0; i < 64; i++ )
+            {
+                bits |= uint64_t( uint32_t( memory[ wordIndex * 64 + i ] ) - 1 < uint32_t( cInstructionCount - 1 ) ) << i;
+            }
+            m_instructionWords[ wordIndex ] = bits;
+            MarkBitmap( m_builtWords, wordIndex );
+        }
+        
+        const int32_t wordEnd = std::min( ( address | 63 ) + 1, end );
+        const uint64_t bits = m_instructionWords[ wordIndex ] & GetBitRange( address, wordEnd );
+        if( bits != 0 )
+        {
+            return wordIndex * 64 + __builtin_ctzll( bits );
+        }
+        address = wordEnd;
+    }
+    return end;
+}
+
+const DecodedBlock& CodeCache::DecodeBlock( const int32_t* memory, int32_t address )
+{
+    // Ops are never reclaimed individually, so start over once too many piled up
+    if( m_ops.size() + cMaxBlockOps + 1 > size_t( cMaxOpCount ) )
+    {
+        Clear();
+    }
+    
+    // Code that has been rewritten gets a single uncached instruction
+    const bool isScratch = IsVolatile( address, GetInstructionLength( GetOpcode( memory, address ) ) );
+    const int maxOpCount = isScratch ? 1 : cMaxBlockOps;
+    
+    DecodedBlock block;
+    block.m_address = address;
+    block.m_firstOp = int32_t( m_ops.size() );
+    block.m_isValid = true;
+    block.m_isReadingMemory = false;
+    block.m_executionCount = 0;
+    block.m_nativeBlock = NULL;
+    
+    // Decoded here first, then either cached or kept for this visit only
+    DecodedOp ops[ cMaxBlockOps + 1 ];
+    int opCount = 0;
+    
+    int32_t instructionPtr = address;
+    int32_t instructionCount = 0;
+    for( ; true; opCount++ )
+    {
+        DecodedOp op;
+        
+        // Memory has guard words past the end, so arguments can always be read
+        const int32_t opcode = GetOpcode( memory, instructionPtr );
+        int32_t kind = opcode;
+        int32_t length = GetInstructionLength( opcode );
+        int32_t fusedCount = 1;
+        op.m_arg0 = memory[ instructionPtr + 1 ];
+        op.m_arg1 = memory[ instructionPtr + 2 ];
+        
+        // Too long, ran off the end of memory, or about to run into volatile code: fall
+        // through into the next block, which reports the out-of-bounds error if there is one
+        if( opCount == maxOpCount || instructionPtr >= cMemorySize || ( opCount > 0 && IsVolatile( instructionPtr, length ) ) )
+        {
+            op.m_kind = cDecoded_Next;
+            op.m_arg0 = op.m_arg1 = 0;
+            op.m_nextAddress = instructionPtr;
+            op.m_instructionCount = instructionCount;
+            ops[ opCount++ ] = op;
+            break;
+        }
+        
+        // Long runs of Nop become a block of their own
+        if( opcode == cInstruction_Nop && !isScratch )
+        {
+            const int32_t instructionAddress = FindInstruction( memory, instructionPtr, std::min( instructionPtr + cMaxNopRunLength, cMemorySize ) );
+            const int32_t runEnd = ( instructionAddress > m_volatileBegin && instructionPtr < m_volatileEnd )
+                ? FindMarked( m_volatile, instructionPtr, instructionAddress ) : instructionAddress;
+            
+            if( runEnd - instructionPtr >= cMinNopRunLength )
+            {
+                if( opCount == 0 )
+                {
+                    op.m_kind = cDecoded_NopRun;
+                    op.m_arg0 = runEnd - instructionPtr;
+                    op.m_arg1 = 0;
+                    instructionPtr = runEnd;
+                    instructionCount = op.m_arg0;
+                }
+                else
+                {
+                    op.m_kind = cDecoded_Next;
+                    op.m_arg0 = op.m_arg1 = 0;
+                }
+                
+                op.m_nextAddress = instructionPtr;
+                op.m_instructionCount = instructionCount;
+                ops[ opCount++ ] = op;
+                break;
+            }
+        }
+        
+        // Superinstructions; every fused instruction must start inside memory
+        if( isScratch )
+        {
+            // Never fused
+        }
+        else if( opcode == cInstruction_SetA && GetOpcode( memory, instructionPtr + 2 ) == cInstruction_ReadA )
+        {
+            kind = cDecoded_SetAReadA;
+            length = 3;
+            fusedCount = 2;
+        }
+        else if( opcode == cInstruction_SetB && GetOpcode( memory, instructionPtr + 2 ) == cInstruction_ReadB )
+        {
+            kind = cDecoded_SetBReadB;
+            length = 3;
+            fusedCount = 2;
+        }
+        else if( opcode == cInstruction_SetB && GetOpcode( memory, instructionPtr + 2 ) == cInstruction_Swap &&
+                 GetOpcode( memory, instructionPtr + 3 ) == cInstruction_Write )
+        {
+            kind = cDecoded_SetBSwapWrite;
+            length = 4;
+            fusedCount = 3;
+        }
+        else if( opcode == cInstruction_SetB && IsCompare( GetOpcode( memory, instructionPtr + 2 ) ) )
+        {
+            kind = cDecoded_SetBEqual + ( GetOpcode( memory, instructionPtr + 2 ) - cInstruction_Equal );
+            length = 3;
+            fusedCount = 2;
+        }
+        else if( opcode == cInstruction_GetPos && GetOpcode( memory, instructionPtr + 1 ) == cInstruction_SetB &&
+                 IsCompare( GetOpcode( memory, instructionPtr + 3 ) ) )
+        {
+            kind = cDecoded_GetPosSetBEqual + ( GetOpcode( memory, instructionPtr + 3 ) - cInstruction_Equal );
+            op.m_arg0 = memory[ instructionPtr + 2 ];
+            length = 4;
+            fusedCount = 3;
+        }
+        else if( opcode == cInstruction_GetPos && GetOpcode( memory, instructionPtr + 1 ) == cInstruction_Swap )
+        {
+            kind = cDecoded_GetPosSwap;
+            length = 2;
+            fusedCount = 2;
+        }
+        
+        // Don't fuse across volatile code either
+        if( fusedCount > 1 && IsVolatile( instructionPtr, length ) )
+        {
+            kind = opcode;
+            length = GetInstructionLength( opcode );
+            fusedCount = 1;
+            op.m_arg0 = memory[ instructionPtr + 1 ];
+        }
+        
+        instructionPtr += length;
+        instructionCount += fusedCount;
+        
+        block.m_isReadingMemory |= ( kind == cInstruction_ReadA || kind == cInstruction_ReadB || kind == cDecoded_SetAReadA || kind == cDecoded_SetBReadB );
+        
+        op.m_kind = kind;
+        op.m_nextAddress = instructionPtr;
+        op.m_instructionCount = instructionCount;
+        ops[ opCount ] = op;
+        
+        if( IsBlockEnd( opcode ) )
+        {
+            opCount++;
+            break;
+        }
+    }
+    
+    block.m_endAddress = instructionPtr;
+    block.m_instructionCount = instructionCount;
+    
+    if( isScratch )
+    {
+        // Good for this visit only
+        std::copy( ops, ops + opCount, m_scratchOps );
+        m_scratchBlock = block;
+        return m_scratchBlock;
+    }
+    
+    m_ops.insert( m_ops.end(), ops, ops + opCount );
+    
+    // Mark every word this block depends on
+    const int32_t coverageEnd = std::min( instructionPtr, cMemorySize );
+    MarkBitmapRange( m_coverage, address, coverageEnd );
+    m_coverageBegin = std::min( m_coverageBegin, address );
+    m_coverageEnd = std::max( m_coverageEnd, coverageEnd );
+    
+    m_blocks.push_back( block );
+    m_blockLookup[ address & ( cBlockLookupSize - 1 ) ] = int32_t( m_blocks.size() );
+    return m_blocks.back();
+}
+
+void CodeCache::InvalidateBlocks( int32_t address )
+{
+    for( size_t i = 0; i < m_blocks.size(); i++ )
+    {
+        DecodedBlock& block = m_blocks[ i ];
+        if( block.m_isValid && address >= block.m_address && address < block.m_endAddress )
+        {
+            block.m_isValid = false;
+        }
+    }
+    
+    // No valid block covers this word any more, and none will again: it is volatile from now on
+    m_coverage[ address >> 6 ] &= ~( uint64_t( 1 ) << ( address & 63 ) );
+    MarkBitmap( m_volatile, address );
+    m_volatileBegin = std::min( m_volatileBegin, address );
+    m_volatileEnd = std::max( m_volatileEnd, address + 1 );
+}
@@ -0,0 +1,218 @@
+//
+//  CodeCache.h
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+// Decoded basic-block cache for a gene's memory. A block is decoded once,
+// starting at the address execution entered it, and ends at the first
+// jump or move (or when it gets too long). Common instruction sequences
+// from the seed scripts are fused into single "superinstructions".
+//
+// Since genes can rewrite their own code, every word a block was decoded
+// from is marked in a coverage bitmap; a write that changes a marked word
+// drops every block built from it. The seed scripts keep their flags inside
+// their own code, so such a word is then marked volatile: blocks end right
+// before it, and it is decoded fresh (one instruction at a time) on every visit.
+//
+// Blocks that keep running get translated to native code, see NativeCode.h.
+//
+// Random padding and mutations leave long runs of words outside the instruction
+// set, which all execute as Nop. A bitmap of the words that do not, kept up to
+// date on every write, finds the end of such a run without walking it; a long
+// run is decoded into a single op that counts every Nop it skips.
+
+#ifndef __CODECACHE_H__
+#define __CODECACHE_H__
+
+#include "SimSnake.h"
+#include "NativeCode.h"
+
+// Decoded operations: the first cInstructionCount match Instruction exactly,
+// the rest are fused sequences of them
+enum DecodedKind
+{
+    // Fused "SetA k, ReadA" and "SetB k, ReadB"
+    cDecoded_SetAReadA = cInstructionCount,
+    cDecoded_SetBReadB,
+    
+    // Fused "SetB k, Swap, Write": mem[k] = a; a = k; b = old a
+    cDecoded_SetBSwapWrite,
+    
+    // Fused "GetPos, Swap": a = y, b = x
+    cDecoded_GetPosSwap,
+    
+    // Fused "SetB k, <compare>"; same order as cInstruction_Equal .. cInstruction_GTE
+    cDecoded_SetBEqual,
+    cDecoded_SetBNE,
+    cDecoded_SetBLT,
+    cDecoded_SetBGT,
+    cDecoded_SetBLTE,
+    cDecoded_SetBGTE,
+    
+    // Fused "GetPos, SetB k, <compare>"; same order as above
+    cDecoded_GetPosSetBEqual,
+    cDecoded_GetPosSetBNE,
+    cDecoded_GetPosSetBLT,
+    cDecoded_GetPosSetBGT,
+    cDecoded_GetPosSetBLTE,
+    cDecoded_GetPosSetBGTE,
+    
+    // Falls through into the block at m_nextAddress
+    cDecoded_Next,
+    
+    // m_arg0 words of Nop, skipped in one go; always a block of its own
+    cDecoded_NopRun,
+    
+    // Must be last!
+    cDecodedKindCount
+};
+
+// One decoded (possibly fused) operation
+struct DecodedOp
+{
+    int32_t m_kind;
+    int32_t m_arg0, m_arg1;
+    
+    // Address right after this operation
+    int32_t m_nextAddress;
+    
+    // Instructions executed from the start of the block up to and including this one
+    int32_t m_instructionCount;
+};
+
+// A straight-line run of decoded operations
+struct DecodedBlock
+{
+    int32_t m_address;
+    int32_t m_endAddress;
+    int32_t m_instructionCount;
+    int32_t m_firstOp;
+    bool m_isValid;
+    
+    // Set if any of its ops reads memory as data
+    bool m_isReadingMemory;
+    
+    // Translated code, once the block got hot (and if it could be translated)
+    int32_t m_executionCount;
+    NativeBlock m_nativeBlock;
+};
+
+class CodeCache
+{
+public:
+    
+    // Blocks never get longer than this many operations, plus a final Next
+    static const int cMaxBlockOps = 64;
+    
+    CodeCache();
+    ~CodeCache();
+    
+    // Returns the block starting at the given (in-bounds) address, decoding it from memory if needed
+    const DecodedBlock& GetBlock( const int32_t* memory, int32_t address )
+    {
+        const int32_t blockIndex = m_blockLookup[ address & ( cBlockLookupSize - 1 ) ] - 1;
+        if( blockIndex >= 0 && m_blocks[ blockIndex ].m_address == address && m_blocks[ blockIndex ].m_isValid )
+        {
+            return m_blocks[ blockIndex ];
+        }
+        return DecodeBlock( memory, address );
+    }
+    
+    const DecodedOp* GetOps( const DecodedBlock& block ) const { return ( &block == &m_scratchBlock ) ? m_scratchOps : &m_ops[ block.m_firstOp ]; }
+    
+    // Native code for the block (see NativeCode.h), or NULL while it is still interpreted;
+    // blocks are translated once they ran cNativeThreshold times, scratch blocks never are
+    NativeBlock GetNativeBlock( const DecodedBlock& block )
+    {
+        if( block.m_nativeBlock != NULL || &block == &m_scratchBlock )
+        {
+            return block.m_nativeBlock;
+        }
+        
+        DecodedBlock& cachedBlock = m_blocks[ &block - &m_blocks.front() ];
+        if( ++cachedBlock.m_executionCount != cNativeThreshold || !NativeCodeArena::IsEnabled() )
+        {
+            return NULL;
+        }
+        cachedBlock.m_nativeBlock = m_nativeCode.Compile( cachedBlock, GetOps( cachedBlock ) );
+        return cachedBlock.m_nativeBlock;
+    }
+    
+    // Must be called after a word of memory changes value; returns true if
+    // any block was decoded from it (which are now gone)
+    bool Invalidate( int32_t address, int32_t value )
+    {
+        if( IsMarked( m_builtWords, address >> 6 ) )
+        {
+            const uint64_t bit = uint64_t( 1 ) << ( address & 63 );
+            const bool isInstruction = uint32_t( value ) - 1 < uint32_t( cInstructionCount - 1 );
+            m_instructionWords[ address >> 6 ] = isInstruction ? ( m_instructionWords[ address >> 6 ] | bit ) : ( m_instructionWords[ address >> 6 ] & ~bit );
+        }
+        
+        if( !IsMarked( m_coverage, address ) )
+        {
+            return false;
+        }
+        InvalidateBlocks( address );
+        return true;
+    }
+    
+    // Drop everything
+    void Clear();
+    
+    // Drop everything, including what is known about memory; for when it was replaced as a whole
+    void Reset();
+
+private:
+    
+    // Direct-mapped lookup from address to block; collisions simply replace the old entry
+    static const int cBlockLookupSize = 4096;
+    
+    // Decoded ops are only reclaimed by a full clear, once this many pile up
+    static const int cMaxOpCount = 65536;
+    
+    // Runs before a block gets translated
+    static const int cNativeThreshold = 32;
+    
+    // Shorter runs of Nop are decoded one op per word, as part of the surrounding block;
+    // runs are never looked at past the point where they would stall anyway
+    static const int cMinNopRunLength = 16;
+    static const int cMaxNopRunLength = cStallCount + 2;
+    
+    const DecodedBlock& DecodeBlock( const int32_t* memory, int32_t address );
+    void InvalidateBlocks( int32_t address );
+    
+    static bool IsMarked( const uint64_t* bitmap, int32_t address ) { return ( bitmap[ address >> 6 ] & ( uint64_t( 1 ) << ( address & 63 ) ) ) != 0; }
+    bool IsVolatile( int32_t address, int32_t length ) const;
+    
+    // First address in [address, end) holding anything but a Nop, or end
+    int32_t FindInstruction( const int32_t* memory, int32_t address, int32_t end );
+    
+    // Block index + 1, 0 for none
+    int32_t* m_blockLookup;
+    
+    std::vector< DecodedBlock > m_blocks;
+    std::vector< DecodedOp > m_ops;
+    
+    // One bit per memory word, set if some block (even an invalidated one) was decoded from it
+    uint64_t* m_coverage;
+    int32_t m_coverageBegin, m_coverageEnd;
+    
+    // One bit per memory word, set once a write changed it after it was decoded
+    uint64_t* m_volatile;
+    int32_t m_volatileBegin, m_volatileEnd;
+    
+    // Blocks starting on volatile code are decoded here and never cached
+    DecodedBlock m_scratchBlock;
+    DecodedOp m_scratchOps[ 2 ];
+    
+    NativeCodeArena m_nativeCode;
+    
+    // One bit per memory word, set if it is an instruction other than Nop; filled in
+    // 64 words at a time on first use, tracked by one bit per 64 words
+    uint64_t* m_instructionWords;
+    uint64_t* m_builtWords;
+};
+
+#endif
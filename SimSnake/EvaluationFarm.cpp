@@ -0,0 +1,511 @@
+//
+//  EvaluationFarm.cpp
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+
+#include "EvaluationFarm.h"
+#include "GenePool.h"
+
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace
+{
+    int64_t GetMilliseconds()
+    {
+        return std::chrono::duration_cast< std::chrono::milliseconds >( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+    
+    // Blocking, no SIGPIPE, and sends and receives give up after the timeout (0 for never)
+    void ConfigureSocket( int socket, int timeout )
+    {
+        fcntl( socket, F_SETFL, fcntl( socket, F_GETFL ) & ~O_NONBLOCK );
+        
+        const int isEnabled = 1;
+        setsockopt( socket, IPPROTO_TCP, TCP_NODELAY, &isEnabled, sizeof( isEnabled ) );
+        #if defined( SO_NOSIGPIPE )
+            setsockopt( socket, SOL_SOCKET, SO_NOSIGPIPE, &isEnabled, sizeof( isEnabled ) );
+        #endif
+        
+        timeval timeLimit = { timeout / 1000, ( timeout % 1000 ) * 1000 };
+        setsockopt( socket, SOL_SOCKET, SO_SNDTIMEO, &timeLimit, sizeof( timeLimit ) );
+        setsockopt( socket, SOL_SOCKET, SO_RCVTIMEO, &timeLimit, sizeof( timeLimit ) );
+    }
+}
+
+EvaluationFarm::EvaluationFarm()
+    : m_listenSocket( -1 )
+    , m_timeout( 10000 )
+{
+}
+
+EvaluationFarm::~EvaluationFarm()
+{
+    while( !m_workers.empty() )
+    {
+        DropWorker( int( m_workers.size() ) - 1 );
+    }
+    
+    if( m_listenSocket >= 0 )
+    {
+        close( m_listenSocket );
+        if( !m_socketPath.empty() )
+        {
+            unlink( m_socketPath.c_str() );
+        }
+    }
+}
+
+bool EvaluationFarm::Listen( const char* address )
+{
+    m_listenSocket = OpenSocket( address, true );
+    if( m_listenSocket < 0 )
+    {
+        printf( "Error: Unable to listen for workers on \"%s\"\n", address );
+        return false;
+    }
+    
+    // Accepting never waits
+    fcntl( m_listenSocket, F_SETFL, fcntl( m_listenSocket, F_GETFL ) | O_NONBLOCK );
+    if( strchr( address, ':' ) == NULL )
+    {
+        m_socketPath = address;
+    }
+    return true;
+}
+
+void EvaluationFarm::AcceptWorkers()
+{
+    if( m_listenSocket < 0 )
+    {
+        return;
+    }
+    
+    for( int socket = accept( m_listenSocket, NULL, NULL ); socket >= 0; socket = accept( m_listenSocket, NULL, NULL ) )
+    {
+        ConfigureSocket( socket, m_timeout );
+        
+        // A new worker starts out holding a zeroed gene, with hashes nothing matches
+        Worker worker;
+        worker.m_socket = socket;
+        worker.m_gene.assign( cMemorySize, 0 );
+        worker.m_chunkHashes.assign( GenePool::cChunkCount, 0 );
+        worker.m_geneHash = 0;
+        worker.m_gameIndex = cIdle;
+        worker.m_deadline = 0;
+        worker.m_isLate = false;
+        m_workers.push_back( worker );
+        
+        printf( "Worker connected, %d in total\n", int( m_workers.size() ) );
+    }
+}
+
+void EvaluationFarm::Evaluate( const GenePool& genePool, uint64_t randomSeed, int boardSize, bool isSharingGames, const std::vector< Game >& games, std::vector< GameResult >& results, const ClaimFunc& claimGame )
+{
+    GameResult unplayedResult = { false, cError_None, 0, 0, 0, 0 };
+    results.assign( games.size(), unplayedResult );
+    if( boardSize < cMinBoardSize || boardSize > cMaxBoardSize )
+    {
+        return;
+    }
+    AcceptWorkers();
+    
+    std::vector< int > pendingGames;
+    for( int i = 0; i < int( games.size() ); i++ )
+    {
+        pendingGames.push_back( i );
+    }
+    std::vector< int > sendCounts( games.size(), 0 );
+    
+    // A game whose worker did not make it goes out again, until it had all its tries
+    auto retryGame = [&]( int gameIndex, const char* reason )
+    {
+        const bool isRetried = sendCounts[ gameIndex ] < cMaxSendCount;
+        printf( "Worker %s; its game %s\n", reason, isRetried ? "goes back in the queue" : "is played locally" );
+        if( isRetried )
+        {
+            pendingGames.push_back( gameIndex );
+        }
+    };
+    
+    while( !m_workers.empty() )
+    {
+        // Idle workers get the next game, preferably of the gene they already hold; games
+        // the caller claimed first, or a late worker answered meanwhile, are dropped
+        for( int i = int( m_workers.size() ) - 1; i >= 0 && !pendingGames.empty(); i-- )
+        {
+            Worker& worker = m_workers[ i ];
+            if( worker.m_gameIndex != cIdle )
+            {
+                continue;
+            }
+            
+            int gameIndex = -1;
+            while( gameIndex < 0 && !pendingGames.empty() )
+            {
+                size_t pendingIndex = 0;
+                while( pendingIndex < pendingGames.size() && genePool.GetGeneHash( games[ pendingGames[ pendingIndex ] ].m_geneIndex ) != worker.m_geneHash )
+                {
+                    pendingIndex++;
+                }
+                if( pendingIndex == pendingGames.size() )
+                {
+                    pendingIndex = 0;
+                }
+                
+                gameIndex = pendingGames[ pendingIndex ];
+                pendingGames.erase( pendingGames.begin() + pendingIndex );
+                if( results[ gameIndex ].m_isPlayed || ( sendCounts[ gameIndex ] == 0 && !claimGame( gameIndex ) ) )
+                {
+                    gameIndex = -1;
+                }
+            }
+            if( gameIndex < 0 )
+            {
+                break;
+            }
+            
+            // Every try gets twice the time of the one before
+            const int64_t timeout = int64_t( m_timeout ) << sendCounts[ gameIndex ];
+            sendCounts[ gameIndex ]++;
+            if( !SendGame( worker, genePool, randomSeed, boardSize, isSharingGames, games[ gameIndex ] ) )
+            {
+                DropWorker( i );
+                retryGame( gameIndex, "lost while sending a game" );
+                continue;
+            }
+            
+            worker.m_gameIndex = gameIndex;
+            worker.m_deadline = GetMilliseconds() + timeout;
+            worker.m_isLate = false;
+        }
+        
+        // Wait for the first answer, or the first worker to run out of time; late workers
+        // are listened to, but not waited for
+        std::vector< pollfd > pollSockets;
+        std::vector< int > pollWorkers;
+        int64_t deadline = INT64_MAX;
+        for( int i = 0; i < int( m_workers.size() ); i++ )
+        {
+            if( m_workers[ i ].m_gameIndex != cIdle )
+            {
+                pollfd pollSocket = { m_workers[ i ].m_socket, POLLIN, 0 };
+                pollSockets.push_back( pollSocket );
+                pollWorkers.push_back( i );
+            }
+            if( m_workers[ i ].m_gameIndex >= 0 && !m_workers[ i ].m_isLate )
+            {
+                deadline = std::min( deadline, m_workers[ i ].m_deadline );
+            }
+        }
+        if( deadline == INT64_MAX )
+        {
+            break;
+        }
+        poll( &pollSockets[ 0 ], pollSockets.size(), int( std::max( int64_t( 0 ), deadline - GetMilliseconds() ) ) );
+        
+        // Back to front, so dropping a worker does not move the ones still to look at
+        const int64_t now = GetMilliseconds();
+        for( int i = int( pollSockets.size() ) - 1; i >= 0; i-- )
+        {
+            Worker& worker = m_workers[ pollWorkers[ i ] ];
+            const bool isWaitedFor = worker.m_gameIndex >= 0 && !worker.m_isLate;
+            if( pollSockets[ i ].revents == 0 )
+            {
+                // Slow is not gone: the worker keeps playing, but its game goes out again
+                if( isWaitedFor && now >= worker.m_deadline )
+                {
+                    worker.m_isLate = true;
+                    retryGame( worker.m_gameIndex, "timed out" );
+                }
+                continue;
+            }
+            
+            GameReply reply;
+            if( !ReceiveAll( worker.m_socket, &reply, sizeof( reply ) ) || reply.m_magic != cReplyMagic )
+            {
+                if( isWaitedFor )
+                {
+                    retryGame( worker.m_gameIndex, "lost" );
+                }
+                DropWorker( pollWorkers[ i ] );
+                continue;
+            }
+            
+            // Whoever answers first plays the game; the rest played the same
+            if( worker.m_gameIndex >= 0 && !results[ worker.m_gameIndex ].m_isPlayed )
+            {
+                GameResult& result = results[ worker.m_gameIndex ];
+                result.m_isPlayed = true;
+                result.m_error = Error( reply.m_error );
+                result.m_fitness = reply.m_fitness;
+                result.m_instructionCount = reply.m_instructionCount;
+                result.m_movementCount = reply.m_movementCount;
+                result.m_pelletCount = reply.m_pelletCount;
+            }
+            worker.m_gameIndex = cIdle;
+            worker.m_isLate = false;
+        }
+    }
+    
+    // Late workers may still answer, but by then the caller has played their games
+    for( size_t i = 0; i < m_workers.size(); i++ )
+    {
+        if( m_workers[ i ].m_gameIndex >= 0 )
+        {
+            m_workers[ i ].m_gameIndex = cEarlierGame;
+        }
+    }
+}
+
+bool EvaluationFarm::SendGame( Worker& worker, const GenePool& genePool, uint64_t randomSeed, int boardSize, bool isSharingGames, const Game& game )
+{
+    const uint64_t geneHash = genePool.GetGeneHash( game.m_geneIndex );
+    
+    // Runs of words that differ from what the worker holds, within chunks that changed
+    m_runWords.clear();
+    int runCount = 0;
+    int32_t runIndex = 0;
+    for( int chunk = 0; chunk < GenePool::cChunkCount && geneHash != worker.m_geneHash; chunk++ )
+    {
+        const uint64_t chunkHash = genePool.GetChunkHash( game.m_geneIndex, chunk );
+        if( chunkHash == worker.m_chunkHashes[ chunk ] )
+        {
+            continue;
+        }
+        worker.m_chunkHashes[ chunk ] = chunkHash;
+        
+        const int32_t* words = genePool.GetChunk( game.m_geneIndex, chunk );
+        for( int32_t i = 0; i < GenePool::cChunkWords; i++ )
+        {
+            const int32_t address = chunk * GenePool::cChunkWords + i;
+            if( words[ i ] == worker.m_gene[ address ] )
+            {
+                continue;
+            }
+            
+            // Close enough to the last run to extend it over the gap (whose words the
+            // worker already holds), or a new run
+            const int32_t runEnd = ( runCount > 0 ) ? m_runWords[ runIndex ] + m_runWords[ runIndex + 1 ] : 0;
+            if( runCount > 0 && address - runEnd <= cMaxRunGap )
+            {
+                m_runWords.insert( m_runWords.end(), worker.m_gene.begin() + runEnd, worker.m_gene.begin() + address );
+                m_runWords.push_back( words[ i ] );
+                m_runWords[ runIndex + 1 ] = address + 1 - m_runWords[ runIndex ];
+            }
+            else
+            {
+                runIndex = int32_t( m_runWords.size() );
+                m_runWords.push_back( address );
+                m_runWords.push_back( 1 );
+                m_runWords.push_back( words[ i ] );
+                runCount++;
+            }
+            worker.m_gene[ address ] = words[ i ];
+        }
+    }
+    worker.m_geneHash = geneHash;
+    
+    GameRequest request = { cRequestMagic, boardSize, game.m_trialIndex, runCount, randomSeed, geneHash, isSharingGames ? 0 : geneHash };
+    return SendAll( worker.m_socket, &request, sizeof( request ) ) && SendAll( worker.m_socket, m_runWords.data(), sizeof( int32_t ) * m_runWords.size() );
+}
+
+void EvaluationFarm::DropWorker( int workerIndex )
+{
+    close( m_workers[ workerIndex ].m_socket );
+    m_workers.erase( m_workers.begin() + workerIndex );
+}
+
+bool EvaluationFarm::RunWorker( const char* address )
+{
+    const int socket = OpenSocket( address, false );
+    if( socket < 0 )
+    {
+        printf( "Error: Unable to connect to the coordinator at \"%s\"\n", address );
+        return false;
+    }
+    ConfigureSocket( socket, 0 );
+    printf( "Connected to the coordinator at \"%s\"\n", address );
+    
+    // The gene as the coordinator last sent it, and the simulation last loaded from it
+    std::vector< int32_t > gene( cMemorySize, 0 );
+    BoardSimulation* board = NULL;
+    uint64_t boardGeneHash = 0;
+    int gameCount = 0;
+    
+    GameRequest request;
+    while( ReceiveAll( socket, &request, sizeof( request ) ) && request.m_magic == cRequestMagic )
+    {
+        bool isValid = request.m_boardSize >= cMinBoardSize && request.m_boardSize <= cMaxBoardSize;
+        for( int i = 0; i < request.m_runCount && isValid; i++ )
+        {
+            int32_t run[ 2 ];
+            isValid = ReceiveAll( socket, run, sizeof( run ) ) && run[ 0 ] >= 0 && run[ 1 ] > 0 && run[ 1 ] <= cMemorySize - run[ 0 ];
+            isValid = isValid && ReceiveAll( socket, &gene[ run[ 0 ] ], sizeof( int32_t ) * run[ 1 ] );
+        }
+        if( !isValid )
+        {
+            break;
+        }
+        
+        // Another game of the gene already loaded only needs a restart
+        const RandomStream random = SimSnake::GetGameRandom( request.m_randomSeed, request.m_gameHash, request.m_trialIndex );
+        if( board == NULL || board->GetBoardSize() != request.m_boardSize )
+        {
+            delete board;
+            board = new BoardSimulation( request.m_boardSize, gene.data(), cMemorySize, random );
+        }
+        else if( request.m_runCount == 0 && request.m_geneHash == boardGeneHash )
+        {
+            board->Restart( random );
+        }
+        else
+        {
+            board->Reset( gene.data(), cMemorySize, random );
+        }
+        boardGeneHash = request.m_geneHash;
+        
+        const Error error = board->RunUntilDeath();
+        GameReply reply = { cReplyMagic, int32_t( error ), board->GetFitness(), board->GetInstructionCount(), board->GetMovementCount(), board->GetPelletCount() };
+        if( !SendAll( socket, &reply, sizeof( reply ) ) )
+        {
+            break;
+        }
+        gameCount++;
+    }
+    
+    printf( "Coordinator went away after %d games\n", gameCount );
+    delete board;
+    close( socket );
+    return true;
+}
+
+int EvaluationFarm::OpenSocket( const char* address, bool isListening )
+{
+    const char* portName = strrchr( address, ':' );
+    if( portName == NULL )
+    {
+        sockaddr_un unixAddress;
+        memset( &unixAddress, 0, sizeof( unixAddress ) );
+        unixAddress.sun_family = AF_UNIX;
+        if( strlen( address ) >= sizeof( unixAddress.sun_path ) )
+        {
+            return -1;
+        }
+        strcpy( unixAddress.sun_path, address );
+        
+        int unixSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if( unixSocket < 0 )
+        {
+            return -1;
+        }
+        
+        // A stale socket file from an earlier run would fail the bind
+        if( isListening )
+        {
+            unlink( address );
+        }
+        
+        const bool isOpen = isListening ? ( bind( unixSocket, (const sockaddr*)&unixAddress, sizeof( unixAddress ) ) == 0 && listen( unixSocket, 64 ) == 0 ) : ( connect( unixSocket, (const sockaddr*)&unixAddress, sizeof( unixAddress ) ) == 0 );
+        if( !isOpen )
+        {
+            close( unixSocket );
+            return -1;
+        }
+        return unixSocket;
+    }
+    
+    // An empty host listens on every interface
+    const std::string hostName( address, portName - address );
+    addrinfo hints;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = isListening ? AI_PASSIVE : 0;
+    
+    addrinfo* addresses = NULL;
+    if( getaddrinfo( hostName.empty() ? NULL : hostName.c_str(), portName + 1, &hints, &addresses ) != 0 )
+    {
+        return -1;
+    }
+    
+    int tcpSocket = -1;
+    for( addrinfo* tcpAddress = addresses; tcpAddress != NULL && tcpSocket < 0; tcpAddress = tcpAddress->ai_next )
+    {
+        tcpSocket = socket( tcpAddress->ai_family, tcpAddress->ai_socktype, tcpAddress->ai_protocol );
+        if( tcpSocket < 0 )
+        {
+            continue;
+        }
+        
+        const int isEnabled = 1;
+        setsockopt( tcpSocket, SOL_SOCKET, SO_REUSEADDR, &isEnabled, sizeof( isEnabled ) );
+        
+        const bool isOpen = isListening ? ( bind( tcpSocket, tcpAddress->ai_addr, tcpAddress->ai_addrlen ) == 0 && listen( tcpSocket, 64 ) == 0 ) : ( connect( tcpSocket, tcpAddress->ai_addr, tcpAddress->ai_addrlen ) == 0 );
+        if( !isOpen )
+        {
+            close( tcpSocket );
+            tcpSocket = -1;
+        }
+    }
+    
+    freeaddrinfo( addresses );
+    return tcpSocket;
+}
+
+bool EvaluationFarm::SendAll( int socket, const void* data, size_t size )
+{
+    #if defined( MSG_NOSIGNAL )
+        const int flags = MSG_NOSIGNAL;
+    #else
+        const int flags = 0;
+    #endif
+    
+    const char* bytes = (const char*)data;
+    while( size > 0 )
+    {
+        const ssize_t sentCount = send( socket, bytes, size, flags );
+        if( sentCount <= 0 )
+        {
+            if( sentCount < 0 && errno == EINTR )
+            {
+                continue;
+            }
+            return false;
+        }
+        bytes += sentCount;
+        size -= size_t( sentCount );
+    }
+    return true;
+}
+
+bool EvaluationFarm::ReceiveAll( int socket, void* data, size_t size )
+{
+    char* bytes = (char*)data;
+    while( size > 0 )
+    {
+        const ssize_t receivedCount = recv( socket, bytes, size, 0 );
+        if( receivedCount <= 0 )
+        {
+            if( receivedCount < 0 && errno == EINTR )
+            {
+                continue;
+            }
+            return false;
+        }
+        bytes += receivedCount;
+        size -= size_t( receivedCount );
+    }
+    return true;
+}
@@ -0,0 +1,157 @@
+//
+//  EvaluationFarm.h
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+// Plays games on worker processes over sockets: a Unix-domain socket path, or
+// "host:port" for TCP (loopback or across machines). The coordinator listens,
+// workers connect whenever they like, and each generation spreads its games over
+// whoever is connected at the time.
+//
+// A game request names the gene by hash, along with the seed and trial index,
+// which is all it takes to rebuild the game's pellet stream (unless every gene
+// plays the same games, in which case the stream's hash is 0). Genes travel as
+// deltas: the coordinator mirrors the last gene it sent each worker, and only
+// sends runs of words that differ, skipping pool chunks whose hashes match. Games
+// of one gene go to the same worker back to back where possible, in which case
+// nothing but the header is sent and the worker just restarts its simulation.
+//
+// A game goes out once the caller lets the farm claim it, so the caller can play
+// the games nobody has taken yet at the same time. A worker that disconnects is
+// dropped, and its game goes back into the queue. One that does not answer in time
+// is only slow: it keeps its game, whose answer still counts if it comes first, but
+// the game also goes to another worker with twice the time. After cMaxSendCount
+// tries the game is left to the caller, like any game nobody could play.
+// Both ends must share byte order and word size.
+
+#ifndef __EVALUATIONFARM_H__
+#define __EVALUATIONFARM_H__
+
+#include "SimSnake.h"
+
+#include <string>
+#include <functional>
+
+class GenePool;
+
+class EvaluationFarm
+{
+public:
+    
+    // A game to play: a gene of the pool and which of its trials
+    struct Game
+    {
+        int m_geneIndex;
+        int m_trialIndex;
+    };
+    
+    // What a worker measured; m_isPlayed is false for games that were not played
+    struct GameResult
+    {
+        bool m_isPlayed;
+        Error m_error;
+        int m_fitness;
+        int m_instructionCount;
+        int m_movementCount;
+        int m_pelletCount;
+    };
+    
+    EvaluationFarm();
+    ~EvaluationFarm();
+    
+    // Starts listening for workers; fails if the address could not be bound
+    bool Listen( const char* address );
+    
+    // Picks up workers that connected since, without waiting
+    void AcceptWorkers();
+    int GetWorkerCount() const { return int( m_workers.size() ); }
+    
+    // How long a worker may take to answer a game it is the first to get before the game
+    // goes out again
+    void SetTimeout( int milliseconds ) { m_timeout = milliseconds; }
+    
+    // Plays the given games on the connected workers, filling in one result per game; with
+    // isSharingGames, every gene plays the same games (see SimSnake::SetIncrementalEvaluation()).
+    // A game is only sent if claimGame( gameIndex ) returns true the first time, and a game
+    // claimed that way but not played is the caller's to play
+    typedef std::function< bool( int ) > ClaimFunc;
+    void Evaluate( const GenePool& genePool, uint64_t randomSeed, int boardSize, bool isSharingGames, const std::vector< Game >& games, std::vector< GameResult >& results, const ClaimFunc& claimGame );
+    
+    // Worker side: connects to a coordinator and plays games until it goes away
+    static bool RunWorker( const char* address );
+
+private:
+    
+    // On the wire: a request is followed by m_runCount runs of words, each as its
+    // address, its word count and then the words
+    struct GameRequest
+    {
+        uint32_t m_magic;
+        int32_t m_boardSize;
+        int32_t m_trialIndex;
+        int32_t m_runCount;
+        uint64_t m_randomSeed;
+        uint64_t m_geneHash;
+        uint64_t m_gameHash;
+    };
+    
+    struct GameReply
+    {
+        uint32_t m_magic;
+        int32_t m_error;
+        int32_t m_fitness;
+        int32_t m_instructionCount;
+        int32_t m_movementCount;
+        int32_t m_pelletCount;
+    };
+    
+    static const uint32_t cRequestMagic = 0x51524E53; // "SNRQ"
+    static const uint32_t cReplyMagic = 0x50524E53; // "SNRP"
+    
+    // Differences closer than this many words are sent as one run
+    static const int cMaxRunGap = 4;
+    
+    // Boards the farm plays on; games on others are left to the caller, and workers drop
+    // a coordinator that asks for one
+    static const int cMinBoardSize = 1;
+    static const int cMaxBoardSize = 1024;
+    
+    // Tries a game gets on the workers, each with twice the time of the last
+    static const int cMaxSendCount = 3;
+    
+    // A connected worker, the gene it holds as far as we know, and its game in flight:
+    // cIdle, cEarlierGame for one from an earlier Evaluate() whose answer is of no use any
+    // more, or a game index, m_isLate once its deadline passed
+    static const int cIdle = -1;
+    static const int cEarlierGame = -2;
+    struct Worker
+    {
+        int m_socket;
+        std::vector< int32_t > m_gene;
+        std::vector< uint64_t > m_chunkHashes;
+        uint64_t m_geneHash;
+        int m_gameIndex;
+        int64_t m_deadline;
+        bool m_isLate;
+    };
+    
+    // Sends the game to the worker; false if the worker is gone
+    bool SendGame( Worker& worker, const GenePool& genePool, uint64_t randomSeed, int boardSize, bool isSharingGames, const Game& game );
+    void DropWorker( int workerIndex );
+    
+    // Address is "host:port" for TCP, a path otherwise; -1 on failure
+    static int OpenSocket( const char* address, bool isListening );
+    static bool SendAll( int socket, const void* data, size_t size );
+    static bool ReceiveAll( int socket, void* data, size_t size );
+    
+    int m_listenSocket;
+    std::string m_socketPath;
+    std::vector< Worker > m_workers;
+    int m_timeout;
+    
+    // Runs of the request being built
+    std::vector< int32_t > m_runWords;
+};
+
+#endif
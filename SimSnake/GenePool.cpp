@@ -0,0 +1,700 @@
+//
+//  GenePool.cpp
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+
+#include "GenePool.h"
+
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace
+{
+    // Hash of a word at the given offset within its segment; a segment's hash is the sum over its words
+    uint64_t HashWord( int32_t offset, int32_t value )
+    {
+        return RandomStream::Mix( ( uint64_t( offset ) << 32 ) | uint32_t( value ) );
+    }
+    
+    // A segment's share of the gene hash
+    uint64_t HashSegment( int segment, uint64_t segmentHash )
+    {
+        return RandomStream::Mix( segmentHash + 0x9E3779B97F4A7C15ull * uint64_t( segment + 1 ) );
+    }
+    
+    // A chunk's lookup hash; the sum of its words' hashes, by offset within the chunk
+    uint64_t HashChunk( const int32_t* words )
+    {
+        uint64_t chunkHash = 0;
+        for( int32_t i = 0; i < GenePool::cChunkWords; i++ )
+        {
+            chunkHash += HashWord( i, words[ i ] );
+        }
+        return chunkHash;
+    }
+}
+
+GenePool::GenePool( int geneCount )
+{
+    // Every gene starts out as zeroes: one shared segment of one shared chunk, whose hashes
+    // are worked out once
+    int32_t zeroWords[ cChunkWords ];
+    memset( zeroWords, 0, sizeof( zeroWords ) );
+    
+    uint64_t zeroSegmentHash = 0;
+    for( int32_t i = 0; i < cSegmentWords; i++ )
+    {
+        zeroSegmentHash += HashWord( i, 0 );
+    }
+    
+    const uint32_t zeroChunk = AddChunk( zeroWords, HashChunk( zeroWords ) );
+    m_chunkRefCounts[ zeroChunk ] = cSegmentChunks;
+    
+    uint32_t zeroChunks[ cSegmentChunks ];
+    std::fill( zeroChunks, zeroChunks + cSegmentChunks, zeroChunk );
+    const uint32_t zeroSegment = AddSegment( zeroChunks, zeroSegmentHash );
+    m_segmentRefCounts[ zeroSegment ] = uint32_t( geneCount ) * cSegmentCount + 1;
+    ReleaseSegment( zeroSegment );
+    
+    m_segmentTables.resize( size_t( geneCount ) * cSegmentCount, zeroSegment );
+    for( int i = 0; i < geneCount; i++ )
+    {
+        Slot slot;
+        slot.m_segments = &m_segmentTables[ size_t( i ) * cSegmentCount ];
+        HashGene( slot );
+        m_slots.push_back( slot );
+    }
+}
+
+GenePool::~GenePool()
+{
+    for( size_t i = 0; i < m_chunkBlocks.size(); i++ )
+    {
+        delete[] m_chunkBlocks[ i ];
+    }
+}
+
+void GenePool::ReadGene( int geneIndex, int32_t* words ) const
+{
+    for( int chunk = 0; chunk < cChunkCount; chunk++ )
+    {
+        memcpy( (void*)( words + chunk * cChunkWords ), (const void*)GetChunk( geneIndex, chunk ), sizeof( int32_t ) * cChunkWords );
+    }
+}
+
+void GenePool::SetGene( int geneIndex, const Gene& gene, uint64_t randomSeed )
+{
+    std::vector< int32_t > words( cMemorySize );
+    
+    const int instructionCount = std::min( (int)gene.size(), cMemorySize );
+    if( instructionCount > 0 )
+    {
+        memcpy( (void*)&words[ 0 ], (const void*)&gene[ 0 ], sizeof( int32_t ) * instructionCount );
+    }
+    
+    // Fill rest with random numbers
+    RandomStream random( randomSeed, cRandomStream_Padding, geneIndex );
+    for( int i = instructionCount; i < cMemorySize; i++ )
+    {
+        words[ i ] = random.NextWord();
+    }
+    
+    SetGene( geneIndex, &words[ 0 ] );
+}
+
+void GenePool::SetGene( int geneIndex, const int32_t* words )
+{
+    Slot& slot = m_slots.at( geneIndex );
+    for( int segment = 0; segment < cSegmentCount; segment++ )
+    {
+        const int32_t* segmentWords = words + segment * cSegmentWords;
+        uint64_t segmentHash = 0;
+        for( int32_t i = 0; i < cSegmentWords; i++ )
+        {
+            segmentHash += HashWord( i, segmentWords[ i ] );
+        }
+        
+        uint32_t chunks[ cSegmentChunks ];
+        for( int i = 0; i < cSegmentChunks; i++ )
+        {
+            chunks[ i ] = AddChunk( segmentWords + i * cChunkWords, HashChunk( segmentWords + i * cChunkWords ) );
+        }
+        SetSegment( slot, segment, AddSegment( chunks, segmentHash ) );
+    }
+    HashGene( slot );
+}
+
+void GenePool::CopyGene( int sourceIndex, int destIndex )
+{
+    const Slot& source = m_slots.at( sourceIndex );
+    Slot& dest = m_slots.at( destIndex );
+    if( &source == &dest )
+    {
+        return;
+    }
+    
+    // Only references get copied
+    for( int segment = 0; segment < cSegmentCount; segment++ )
+    {
+        m_segmentRefCounts[ source.m_segments[ segment ] ]++;
+        SetSegment( dest, segment, source.m_segments[ segment ] );
+    }
+    dest.m_hash = source.m_hash;
+}
+
+void GenePool::CopySegment( int sourceIndex, int sourceSegment, int destIndex, int destSegment )
+{
+    const Slot& source = m_slots.at( sourceIndex );
+    Slot& dest = m_slots.at( destIndex );
+    
+    // Word hashes only depend on the offset within the segment, so the segment hash moves along
+    const uint32_t storedSegment = source.m_segments[ sourceSegment ];
+    dest.m_hash += HashSegment( destSegment, m_segmentHashes[ storedSegment ] ) - HashSegment( destSegment, m_segmentHashes[ dest.m_segments[ destSegment ] ] );
+    
+    m_segmentRefCounts[ storedSegment ]++;
+    SetSegment( dest, destSegment, storedSegment );
+}
+
+void GenePool::SetWord( int geneIndex, int32_t address, int32_t value )
+{
+    Slot& slot = m_slots.at( geneIndex );
+    const int segment = address / cSegmentWords;
+    const int32_t offset = address % cSegmentWords;
+    const int32_t chunkOffset = address % cChunkWords;
+    
+    const uint32_t storedSegment = GetEditableSegment( slot, segment );
+    uint32_t& storedChunk = m_segmentChunks[ size_t( storedSegment ) * cSegmentChunks + offset / cChunkWords ];
+    const int32_t* words = GetChunkWords( storedChunk );
+    
+    const uint64_t segmentHash = m_segmentHashes[ storedSegment ] - HashWord( offset, words[ chunkOffset ] ) + HashWord( offset, value );
+    slot.m_hash += HashSegment( segment, segmentHash ) - HashSegment( segment, m_segmentHashes[ storedSegment ] );
+    m_segmentHashes[ storedSegment ] = segmentHash;
+    
+    const uint64_t chunkHash = m_chunkHashes[ storedChunk ] - HashWord( chunkOffset, words[ chunkOffset ] ) + HashWord( chunkOffset, value );
+    
+    // A chunk nobody else holds can be edited where it is; a shared one has the edited
+    // words stored as a chunk of their own. Either way the result is not looked up
+    if( m_chunkRefCounts[ storedChunk ] == 1 )
+    {
+        RemoveChunkFromLookup( storedChunk );
+        GetChunkWords( storedChunk )[ chunkOffset ] = value;
+        m_chunkHashes[ storedChunk ] = chunkHash;
+        return;
+    }
+    
+    int32_t editedWords[ cChunkWords ];
+    memcpy( (void*)editedWords, (const void*)words, sizeof( editedWords ) );
+    editedWords[ chunkOffset ] = value;
+    
+    const uint32_t oldChunk = storedChunk;
+    storedChunk = StoreChunk( editedWords, chunkHash );
+    ReleaseChunk( oldChunk );
+}
+
+void GenePool::StartDraft( GeneDraft& draft, int sourceIndex ) const
+{
+    const Slot& source = m_slots.at( sourceIndex );
+    draft.m_segments.assign( source.m_segments, source.m_segments + cSegmentCount );
+    draft.m_hash = source.m_hash;
+    
+    // Only the segments edited last time need clearing
+    draft.m_editIndices.resize( cSegmentCount, -1 );
+    for( int i = 0; i < draft.m_editedSegmentCount; i++ )
+    {
+        draft.m_editIndices[ draft.m_editedSegments[ i ] ] = -1;
+    }
+    draft.m_editedSegmentCount = 0;
+    draft.m_editedChunkCount = 0;
+    draft.m_wordEditCount = 0;
+}
+
+void GenePool::DraftSegment( GeneDraft& draft, int sourceIndex, int sourceSegment, int destSegment ) const
+{
+    const Slot& source = m_slots.at( sourceIndex );
+    
+    // Edits to the segment are simply dropped, they are never looked at again
+    const int editIndex = draft.m_editIndices[ destSegment ];
+    const uint64_t oldSegmentHash = ( editIndex >= 0 ) ? draft.m_editedSegmentHashes[ editIndex ] : m_segmentHashes[ draft.m_segments[ destSegment ] ];
+    draft.m_editIndices[ destSegment ] = -1;
+    
+    draft.m_segments[ destSegment ] = source.m_segments[ sourceSegment ];
+    draft.m_hash += HashSegment( destSegment, m_segmentHashes[ source.m_segments[ sourceSegment ] ] ) - HashSegment( destSegment, oldSegmentHash );
+}
+
+void GenePool::DraftWord( GeneDraft& draft, int32_t address, int32_t value ) const
+{
+    const int segment = address / cSegmentWords;
+    const int32_t offset = address % cSegmentWords;
+    const int segmentChunk = offset / cChunkWords;
+    const int32_t chunkOffset = address % cChunkWords;
+    
+    // First edit of the segment starts out with its chunks as they are
+    int editIndex = draft.m_editIndices[ segment ];
+    if( editIndex < 0 )
+    {
+        editIndex = draft.m_editedSegmentCount++;
+        if( int( draft.m_editedSegments.size() ) < draft.m_editedSegmentCount )
+        {
+            draft.m_editedSegments.resize( draft.m_editedSegmentCount );
+            draft.m_editedSegmentHashes.resize( draft.m_editedSegmentCount );
+            draft.m_editedChunkIndices.resize( size_t( draft.m_editedSegmentCount ) * cSegmentChunks );
+        }
+        
+        draft.m_editedSegments[ editIndex ] = segment;
+        draft.m_editedSegmentHashes[ editIndex ] = m_segmentHashes[ draft.m_segments[ segment ] ];
+        std::fill( &draft.m_editedChunkIndices[ size_t( editIndex ) * cSegmentChunks ], &draft.m_editedChunkIndices[ size_t( editIndex ) * cSegmentChunks ] + cSegmentChunks, -1 );
+        draft.m_editIndices[ segment ] = editIndex;
+    }
+    
+    const uint32_t storedChunk = m_segmentChunks[ size_t( draft.m_segments[ segment ] ) * cSegmentChunks + segmentChunk ];
+    int& chunkIndex = draft.m_editedChunkIndices[ size_t( editIndex ) * cSegmentChunks + segmentChunk ];
+    if( chunkIndex < 0 )
+    {
+        chunkIndex = draft.m_editedChunkCount++;
+        if( int( draft.m_editedChunkHashes.size() ) < draft.m_editedChunkCount )
+        {
+            draft.m_editedChunkHashes.resize( draft.m_editedChunkCount );
+        }
+        draft.m_editedChunkHashes[ chunkIndex ] = m_chunkHashes[ storedChunk ];
+    }
+    
+    // The word as it is now: the last edit to it, if any, otherwise what is stored
+    int32_t oldValue = GetChunkWords( storedChunk )[ chunkOffset ];
+    for( int i = draft.m_wordEditCount - 1; i >= 0; i-- )
+    {
+        if( draft.m_wordAddresses[ i ] == address && draft.m_wordEditIndices[ i ] == editIndex )
+        {
+            oldValue = draft.m_wordValues[ i ];
+            break;
+        }
+    }
+    
+    const int wordEditIndex = draft.m_wordEditCount++;
+    if( int( draft.m_wordAddresses.size() ) < draft.m_wordEditCount )
+    {
+        draft.m_wordEditIndices.resize( draft.m_wordEditCount );
+        draft.m_wordAddresses.resize( draft.m_wordEditCount );
+        draft.m_wordValues.resize( draft.m_wordEditCount );
+    }
+    draft.m_wordEditIndices[ wordEditIndex ] = editIndex;
+    draft.m_wordAddresses[ wordEditIndex ] = address;
+    draft.m_wordValues[ wordEditIndex ] = value;
+    
+    draft.m_editedChunkHashes[ chunkIndex ] += HashWord( chunkOffset, value ) - HashWord( chunkOffset, oldValue );
+    
+    uint64_t& segmentHash = draft.m_editedSegmentHashes[ editIndex ];
+    const uint64_t oldSegmentHash = segmentHash;
+    segmentHash += HashWord( offset, value ) - HashWord( offset, oldValue );
+    draft.m_hash += HashSegment( segment, segmentHash ) - HashSegment( segment, oldSegmentHash );
+}
+
+void GenePool::CommitDraft( GeneDraft& draft, int destIndex )
+{
+    Slot& dest = m_slots.at( destIndex );
+    
+    // References the slot already holds stay as they are
+    for( int segment = 0; segment < cSegmentCount; segment++ )
+    {
+        const int editIndex = draft.m_editIndices[ segment ];
+        if( editIndex < 0 )
+        {
+            if( dest.m_segments[ segment ] != draft.m_segments[ segment ] )
+            {
+                m_segmentRefCounts[ draft.m_segments[ segment ] ]++;
+                SetSegment( dest, segment, draft.m_segments[ segment ] );
+            }
+            continue;
+        }
+        
+        // Edited chunks get room of their own, the others are shared with the segment the
+        // draft started from
+        if( draft.m_storedChunks.size() < draft.m_editedChunkHashes.size() )
+        {
+            draft.m_storedChunks.resize( draft.m_editedChunkHashes.size() );
+        }
+        
+        uint32_t chunks[ cSegmentChunks ];
+        for( int i = 0; i < cSegmentChunks; i++ )
+        {
+            const int chunkIndex = draft.m_editedChunkIndices[ size_t( editIndex ) * cSegmentChunks + i ];
+            if( chunkIndex >= 0 )
+            {
+                chunks[ i ] = AllocateChunk( draft.m_editedChunkHashes[ chunkIndex ] );
+                draft.m_storedChunks[ chunkIndex ] = chunks[ i ];
+            }
+            else
+            {
+                chunks[ i ] = m_segmentChunks[ size_t( draft.m_segments[ segment ] ) * cSegmentChunks + i ];
+                m_chunkRefCounts[ chunks[ i ] ]++;
+            }
+        }
+        SetSegment( dest, segment, StoreSegment( chunks, draft.m_editedSegmentHashes[ editIndex ] ) );
+    }
+    dest.m_hash = draft.m_hash;
+}
+
+void GenePool::WriteDraft( const GeneDraft& draft ) const
+{
+    // Every edited chunk starts out as a copy of the one it replaces
+    for( int editIndex = 0; editIndex < draft.m_editedSegmentCount; editIndex++ )
+    {
+        const int segment = draft.m_editedSegments[ editIndex ];
+        if( draft.m_editIndices[ segment ] != editIndex )
+        {
+            continue;
+        }
+        
+        for( int i = 0; i < cSegmentChunks; i++ )
+        {
+            const int chunkIndex = draft.m_editedChunkIndices[ size_t( editIndex ) * cSegmentChunks + i ];
+            if( chunkIndex >= 0 )
+            {
+                const uint32_t sourceChunk = m_segmentChunks[ size_t( draft.m_segments[ segment ] ) * cSegmentChunks + i ];
+                memcpy( (void*)GetChunkWords( draft.m_storedChunks[ chunkIndex ] ), (const void*)GetChunkWords( sourceChunk ), sizeof( int32_t ) * cChunkWords );
+            }
+        }
+    }
+    
+    // Then edits go in, in order; those to segments that were copied over since are gone
+    for( int i = 0; i < draft.m_wordEditCount; i++ )
+    {
+        const int editIndex = draft.m_wordEditIndices[ i ];
+        const int32_t address = draft.m_wordAddresses[ i ];
+        const int segment = address / cSegmentWords;
+        if( draft.m_editIndices[ segment ] != editIndex )
+        {
+            continue;
+        }
+        
+        const int chunkIndex = draft.m_editedChunkIndices[ size_t( editIndex ) * cSegmentChunks + ( address % cSegmentWords ) / cChunkWords ];
+        GetChunkWords( draft.m_storedChunks[ chunkIndex ] )[ address % cChunkWords ] = draft.m_wordValues[ i ];
+    }
+}
+
+void GenePool::Swap( GenePool& other )
+{
+    // Slots point into their own pool's segment tables, whose storage moves along
+    m_slots.swap( other.m_slots );
+    m_segmentTables.swap( other.m_segmentTables );
+    m_segmentChunks.swap( other.m_segmentChunks );
+    m_segmentRefCounts.swap( other.m_segmentRefCounts );
+    m_segmentHashes.swap( other.m_segmentHashes );
+    m_isSegmentLookedUp.swap( other.m_isSegmentLookedUp );
+    m_freeSegments.swap( other.m_freeSegments );
+    m_segmentLookup.swap( other.m_segmentLookup );
+    m_chunkBlocks.swap( other.m_chunkBlocks );
+    m_chunkRefCounts.swap( other.m_chunkRefCounts );
+    m_chunkHashes.swap( other.m_chunkHashes );
+    m_isChunkLookedUp.swap( other.m_isChunkLookedUp );
+    m_freeChunks.swap( other.m_freeChunks );
+    m_chunkLookup.swap( other.m_chunkLookup );
+}
+
+void GenePool::HashGene( Slot& slot )
+{
+    slot.m_hash = 0;
+    for( int segment = 0; segment < cSegmentCount; segment++ )
+    {
+        slot.m_hash += HashSegment( segment, m_segmentHashes[ slot.m_segments[ segment ] ] );
+    }
+}
+
+uint32_t GenePool::AddChunk( const int32_t* words, uint64_t chunkHash )
+{
+    std::unordered_map< uint64_t, uint32_t >::const_iterator sharedChunk = m_chunkLookup.find( chunkHash );
+    if( sharedChunk != m_chunkLookup.end() && memcmp( (const void*)GetChunkWords( sharedChunk->second ), (const void*)words, sizeof( int32_t ) * cChunkWords ) == 0 )
+    {
+        m_chunkRefCounts[ sharedChunk->second ]++;
+        return sharedChunk->second;
+    }
+    
+    const uint32_t chunk = StoreChunk( words, chunkHash );
+    if( sharedChunk == m_chunkLookup.end() )
+    {
+        m_chunkLookup[ chunkHash ] = chunk;
+        m_isChunkLookedUp[ chunk ] = true;
+    }
+    return chunk;
+}
+
+uint32_t GenePool::StoreChunk( const int32_t* words, uint64_t chunkHash )
+{
+    const uint32_t chunk = AllocateChunk( chunkHash );
+    memcpy( (void*)GetChunkWords( chunk ), (const void*)words, sizeof( int32_t ) * cChunkWords );
+    return chunk;
+}
+
+uint32_t GenePool::AllocateChunk( uint64_t chunkHash )
+{
+    uint32_t chunk = 0;
+    if( !m_freeChunks.empty() )
+    {
+        chunk = m_freeChunks.back();
+        m_freeChunks.pop_back();
+    }
+    else
+    {
+        chunk = uint32_t( m_chunkRefCounts.size() );
+        if( chunk % cBlockChunks == 0 )
+        {
+            m_chunkBlocks.push_back( new int32_t[ size_t( cBlockChunks ) * cChunkWords ] );
+        }
+        m_chunkRefCounts.push_back( 0 );
+        m_chunkHashes.push_back( 0 );
+        m_isChunkLookedUp.push_back( false );
+    }
+    
+    m_chunkRefCounts[ chunk ] = 1;
+    m_chunkHashes[ chunk ] = chunkHash;
+    return chunk;
+}
+
+void GenePool::ReleaseChunk( uint32_t chunk )
+{
+    if( --m_chunkRefCounts[ chunk ] > 0 )
+    {
+        return;
+    }
+    
+    RemoveChunkFromLookup( chunk );
+    m_freeChunks.push_back( chunk );
+}
+
+void GenePool::RemoveChunkFromLookup( uint32_t chunk )
+{
+    if( m_isChunkLookedUp[ chunk ] )
+    {
+        m_chunkLookup.erase( m_chunkHashes[ chunk ] );
+        m_isChunkLookedUp[ chunk ] = false;
+    }
+}
+
+uint32_t GenePool::AddSegment( const uint32_t* chunks, uint64_t segmentHash )
+{
+    // Equal chunks are the same stored chunks, as long as they were looked up as well
+    std::unordered_map< uint64_t, uint32_t >::const_iterator sharedSegment = m_segmentLookup.find( segmentHash );
+    if( sharedSegment != m_segmentLookup.end() && memcmp( (const void*)&m_segmentChunks[ size_t( sharedSegment->second ) * cSegmentChunks ], (const void*)chunks, sizeof( uint32_t ) * cSegmentChunks ) == 0 )
+    {
+        for( int i = 0; i < cSegmentChunks; i++ )
+        {
+            ReleaseChunk( chunks[ i ] );
+        }
+        m_segmentRefCounts[ sharedSegment->second ]++;
+        return sharedSegment->second;
+    }
+    
+    const uint32_t storedSegment = StoreSegment( chunks, segmentHash );
+    if( sharedSegment == m_segmentLookup.end() )
+    {
+        m_segmentLookup[ segmentHash ] = storedSegment;
+        m_isSegmentLookedUp[ storedSegment ] = true;
+    }
+    return storedSegment;
+}
+
+uint32_t GenePool::StoreSegment( const uint32_t* chunks, uint64_t segmentHash )
+{
+    uint32_t storedSegment = 0;
+    if( !m_freeSegments.empty() )
+    {
+        storedSegment = m_freeSegments.back();
+        m_freeSegments.pop_back();
+    }
+    else
+    {
+        storedSegment = uint32_t( m_segmentRefCounts.size() );
+        m_segmentChunks.resize( m_segmentChunks.size() + cSegmentChunks );
+        m_segmentRefCounts.push_back( 0 );
+        m_segmentHashes.push_back( 0 );
+        m_isSegmentLookedUp.push_back( false );
+    }
+    
+    memcpy( (void*)&m_segmentChunks[ size_t( storedSegment ) * cSegmentChunks ], (const void*)chunks, sizeof( uint32_t ) * cSegmentChunks );
+    m_segmentRefCounts[ storedSegment ] = 1;
+    m_segmentHashes[ storedSegment ] = segmentHash;
+    return storedSegment;
+}
+
+void GenePool::ReleaseSegment( uint32_t storedSegment )
+{
+    if( --m_segmentRefCounts[ storedSegment ] > 0 )
+    {
+        return;
+    }
+    
+    for( int i = 0; i < cSegmentChunks; i++ )
+    {
+        ReleaseChunk( m_segmentChunks[ size_t( storedSegment ) * cSegmentChunks + i ] );
+    }
+    RemoveSegmentFromLookup( storedSegment );
+    m_freeSegments.push_back( storedSegment );
+}
+
+void GenePool::RemoveSegmentFromLookup( uint32_t storedSegment )
+{
+    if( m_isSegmentLookedUp[ storedSegment ] )
+    {
+        m_segmentLookup.erase( m_segmentHashes[ storedSegment ] );
+        m_isSegmentLookedUp[ storedSegment ] = false;
+    }
+}
+
+void GenePool::SetSegment( Slot& slot, int segment, uint32_t storedSegment )
+{
+    const uint32_t oldSegment = slot.m_segments[ segment ];
+    slot.m_segments[ segment ] = storedSegment;
+    ReleaseSegment( oldSegment );
+}
+
+uint32_t GenePool::GetEditableSegment( Slot& slot, int segment )
+{
+    const uint32_t storedSegment = slot.m_segments[ segment ];
+    if( m_segmentRefCounts[ storedSegment ] == 1 )
+    {
+        RemoveSegmentFromLookup( storedSegment );
+        return storedSegment;
+    }
+    
+    // A copy of our own, sharing every chunk
+    uint32_t chunks[ cSegmentChunks ];
+    for( int i = 0; i < cSegmentChunks; i++ )
+    {
+        chunks[ i ] = m_segmentChunks[ size_t( storedSegment ) * cSegmentChunks + i ];
+        m_chunkRefCounts[ chunks[ i ] ]++;
+    }
+    
+    const uint32_t editableSegment = StoreSegment( chunks, m_segmentHashes[ storedSegment ] );
+    SetSegment( slot, segment, editableSegment );
+    return editableSegment;
+}
+
+void GenePool::Reorder( const std::vector< int >& order )
+{
+    std::vector< Slot > slots;
+    std::vector< bool > isUsed( m_slots.size(), false );
+    
+    for( size_t i = 0; i < order.size(); i++ )
+    {
+        slots.push_back( m_slots.at( order[ i ] ) );
+        isUsed.at( order[ i ] ) = true;
+    }
+    
+    // Whatever wasn't picked fills the remaining slots
+    for( size_t i = 0; i < m_slots.size(); i++ )
+    {
+        if( !isUsed[ i ] )
+        {
+            slots.push_back( m_slots[ i ] );
+        }
+    }
+    
+    m_slots.swap( slots );
+}
+
+bool GenePool::LoadSnapshot( const char* fileName )
+{
+    int file = open( fileName, O_RDONLY );
+    if( file < 0 )
+    {
+        return false;
+    }
+    
+    // Validate the header and that every slot is present before reading anything
+    FileHeader header;
+    struct stat fileStat;
+    bool isValid = ( pread( file, &header, sizeof( header ), 0 ) == ssize_t( sizeof( header ) ) ) &&
+                   ( fstat( file, &fileStat ) == 0 ) &&
+                   header.m_magic == cFileMagic &&
+                   header.m_version == cFileVersion &&
+                   header.m_geneCount == uint32_t( GetGeneCount() ) &&
+                   header.m_geneWordCount == uint32_t( cMemorySize ) &&
+                   size_t( fileStat.st_size ) >= cHeaderSize + sizeof( int32_t ) * cMemorySize * GetGeneCount();
+    
+    if( !isValid )
+    {
+        printf( "Error: \"%s\" is not a population file for %d genes\n", fileName, GetGeneCount() );
+        close( file );
+        return false;
+    }
+    
+    // Read every gene in turn into a pool of its own, sharing whatever chunks it has in
+    // common with those before, so a read failing part-way leaves this one as it was
+    GenePool loadedPool( GetGeneCount() );
+    std::vector< int32_t > words( cMemorySize );
+    for( int i = 0; i < GetGeneCount() && isValid; i++ )
+    {
+        const size_t slotSize = sizeof( int32_t ) * cMemorySize;
+        isValid = ( pread( file, (void*)&words[ 0 ], slotSize, cHeaderSize + slotSize * i ) == ssize_t( slotSize ) );
+        if( isValid )
+        {
+            loadedPool.SetGene( i, &words[ 0 ] );
+        }
+    }
+    close( file );
+    
+    if( !isValid )
+    {
+        printf( "Error: Unable to read the population file \"%s\"\n", fileName );
+        return false;
+    }
+    
+    Swap( loadedPool );
+    return true;
+}
+
+bool GenePool::SaveSnapshot( const char* fileName ) const
+{
+    return SaveSnapshot( fileName, GetGeneCount(), [this]( int geneIndex, int32_t* words ) { ReadGene( geneIndex, words ); } );
+}
+
+bool GenePool::SaveSnapshot( const char* fileName, int geneCount, const std::function< void( int, int32_t* ) >& readGene )
+{
+    // Write next to the target and rename over it, so a crash mid-save never
+    // leaves a half-written population behind
+    std::string tempFileName = std::string( fileName ) + ".tmp";
+    
+    FILE* file = NULL;
+    if( (file = fopen( tempFileName.c_str(), "wb" )) == NULL )
+    {
+        printf( "Error: Unable to save the population to \"%s\"\n", tempFileName.c_str() );
+        return false;
+    }
+    
+    char headerPage[ cHeaderSize ];
+    memset( headerPage, 0, sizeof( headerPage ) );
+    
+    FileHeader header;
+    header.m_magic = cFileMagic;
+    header.m_version = cFileVersion;
+    header.m_geneCount = uint32_t( geneCount );
+    header.m_geneWordCount = uint32_t( cMemorySize );
+    memcpy( headerPage, &header, sizeof( header ) );
+    
+    bool success = ( fwrite( headerPage, sizeof( headerPage ), 1, file ) == 1 );
+    
+    // Genes are written out in full, in index order
+    std::vector< int32_t > words( cMemorySize );
+    for( int i = 0; i < geneCount && success; i++ )
+    {
+        readGene( i, &words[ 0 ] );
+        success = ( fwrite( (const void*)&words[ 0 ], sizeof( int32_t ), cMemorySize, file ) == size_t( cMemorySize ) );
+    }
+    
+    success &= ( fclose( file ) == 0 );
+    
+    if( !success || rename( tempFileName.c_str(), fileName ) != 0 )
+    {
+        printf( "Error: Unable to save the population to \"%s\"\n", fileName );
+        remove( tempFileName.c_str() );
+        return false;
+    }
+    
+    return true;
+}
@@ -0,0 +1,218 @@
+//
+//  GenePool.h
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+// Resident store of every gene in the population. A gene is a table of
+// references to stored segments, each a table of references to chunks of
+// cChunkWords words; both are shared by every gene (and every position) holding
+// the same words, and only change while a single gene holds them. Breeding
+// copies whole segments and genes, which only copies one reference per segment,
+// and a changed word gets its segment and chunk copied first if they are shared.
+// Children differ from their parents by a few mutated chunks, so a population
+// costs little more than its distinct chunks; disk is only touched for snapshots.
+//
+// Snapshots are a single file: a one-page header followed by every gene's words
+// in full, in index order. Loading reads them and shares chunks again as it goes;
+// since a gene is then made of pooled chunks, not the file's pages, there is no
+// mapping the file in place of copying it.
+//
+// Every gene also has a content hash. It is the sum of one term per segment
+// (cSegmentWords words), each a hash of that segment's words, so copying a
+// whole segment or changing one word updates it in constant time as long as
+// the change is made through the pool. Chunks are looked up by a hash of their
+// words the same way, and stored segments by their segment hash.
+
+#ifndef __GENEPOOL_H__
+#define __GENEPOOL_H__
+
+#include "SimSnake.h"
+#include <functional>
+
+// Default snapshot file, relative to the working directory
+static const char* cGenePoolFileName = "GenePool";
+
+// A gene put together away from the pool, for breeding many at once. Building one only
+// reads the pool, so any number can be built in parallel as long as the pool is left
+// alone; they are then committed one at a time, which only links references, and their
+// words written, again in parallel. Buffers are kept, so a reused draft does not
+// allocate once it has grown to size; the members are the pool's business (see GenePool)
+struct GeneDraft
+{
+    GeneDraft() : m_hash( 0 ), m_editedSegmentCount( 0 ), m_editedChunkCount( 0 ), m_wordEditCount( 0 ) {}
+    
+    // Segment table and hash, as a slot has them
+    std::vector< uint32_t > m_segments;
+    uint64_t m_hash;
+    
+    // Segments with words changed: their index into the edited segment lists (-1 if none);
+    // per edited segment, which one it is, its hash and, for each of its chunks, the index
+    // into the edited chunk hashes (-1 if unchanged)
+    std::vector< int > m_editIndices;
+    std::vector< int > m_editedSegments;
+    std::vector< uint64_t > m_editedSegmentHashes;
+    std::vector< int > m_editedChunkIndices;
+    int m_editedSegmentCount;
+    
+    // Per edited chunk, its hash and, once committed, where it went
+    std::vector< uint64_t > m_editedChunkHashes;
+    std::vector< uint32_t > m_storedChunks;
+    int m_editedChunkCount;
+    
+    // The words themselves are only written on commit; per word edit, the edited segment
+    // it went to, its address and value
+    std::vector< int > m_wordEditIndices;
+    std::vector< int32_t > m_wordAddresses;
+    std::vector< int32_t > m_wordValues;
+    int m_wordEditCount;
+};
+
+class GenePool
+{
+public:
+    
+    GenePool( int geneCount );
+    ~GenePool();
+    
+    int GetGeneCount() const { return int( m_slots.size() ); }
+    
+    // Read access a chunk at a time; chunk i holds the gene's words from i * cChunkWords on.
+    // Chunks with equal hashes hold the same words. Writes go through the calls below,
+    // which keep every hash current
+    static const int cChunkWords = 256;
+    static const int cChunkCount = cMemorySize / cChunkWords;
+    const int32_t* GetChunk( int geneIndex, int chunk ) const { return GetChunkWords( GetStoredChunk( geneIndex, chunk ) ); }
+    uint64_t GetChunkHash( int geneIndex, int chunk ) const { return m_chunkHashes[ GetStoredChunk( geneIndex, chunk ) ]; }
+    
+    // Copies all cMemorySize words of a gene out
+    void ReadGene( int geneIndex, int32_t* words ) const;
+    
+    // Content hash; equal genes always have equal hashes
+    uint64_t GetGeneHash( int geneIndex ) const { return m_slots.at( geneIndex ).m_hash; }
+    
+    // Hash of one segment's words (see below); equal segments have equal hashes
+    uint64_t GetSegmentHash( int geneIndex, int segment ) const { return m_segmentHashes[ m_slots.at( geneIndex ).m_segments[ segment ] ]; }
+    
+    // Copies the given gene into a slot, padding the rest with random data from the
+    // seed's padding stream for that slot
+    void SetGene( int geneIndex, const Gene& gene, uint64_t randomSeed = 0 );
+    
+    // Copies a whole slot's worth (cMemorySize words) into a slot
+    void SetGene( int geneIndex, const int32_t* words );
+    
+    // In-pool copies and edits, for breeding
+    static const int cSegmentWords = cMemorySize / 128;
+    static const int cSegmentCount = cMemorySize / cSegmentWords;
+    static const int cSegmentChunks = cSegmentWords / cChunkWords;
+    void CopyGene( int sourceIndex, int destIndex );
+    void CopySegment( int sourceIndex, int sourceSegment, int destIndex, int destSegment );
+    void SetWord( int geneIndex, int32_t address, int32_t value );
+    
+    // Same as CopyGene(), CopySegment() and SetWord(), on a draft; the draft only refers to the
+    // pool's segments, so the genes it was built from must not change until it is written.
+    // Committing puts the draft in a slot, but the words it changed are left unset until
+    // WriteDraft(), which may run for any number of committed drafts at once
+    void StartDraft( GeneDraft& draft, int sourceIndex ) const;
+    void DraftSegment( GeneDraft& draft, int sourceIndex, int sourceSegment, int destSegment ) const;
+    void DraftWord( GeneDraft& draft, int32_t address, int32_t value ) const;
+    void CommitDraft( GeneDraft& draft, int destIndex );
+    void WriteDraft( const GeneDraft& draft ) const;
+    
+    // Distinct chunks held, across all genes
+    int GetStoredChunkCount() const { return int( m_chunkRefCounts.size() - m_freeChunks.size() ); }
+    
+    // Re-orders slots so that slot i holds what was in slot "order[i]"; order must
+    // list distinct slot indices, and may be shorter than the pool, in which case
+    // the remaining slots get the left-over genes in no particular order
+    void Reorder( const std::vector< int >& order );
+    
+    // Snapshot to / from a population file; loading fails (and leaves the pool
+    // untouched) if the file is missing, short or was written for a different pool size
+    bool LoadSnapshot( const char* fileName = cGenePoolFileName );
+    bool SaveSnapshot( const char* fileName = cGenePoolFileName ) const;
+    
+    // Same, but fetching each gene's words through readGene( geneIndex, words ) in turn, for
+    // a pool that may change in-between genes (see SimSnake::SaveGenePool())
+    static bool SaveSnapshot( const char* fileName, int geneCount, const std::function< void( int, int32_t* ) >& readGene );
+    
+private:
+    
+    // On-disk header, padded out to cHeaderSize; genes follow it
+    struct FileHeader
+    {
+        uint32_t m_magic;
+        uint32_t m_version;
+        uint32_t m_geneCount;
+        uint32_t m_geneWordCount;
+    };
+    
+    static const uint32_t cFileMagic = 0x504B4E53; // "SNKP"
+    static const uint32_t cFileVersion = 1;
+    static const size_t cHeaderSize = 4096;
+    
+    static_assert( cSegmentWords % cChunkWords == 0, "Segments must be whole chunks" );
+    
+    // A gene's stored segments, and its hash
+    struct Slot
+    {
+        uint32_t* m_segments;
+        uint64_t m_hash;
+    };
+    
+    uint32_t GetStoredChunk( int geneIndex, int chunk ) const { return m_segmentChunks[ size_t( m_slots.at( geneIndex ).m_segments[ chunk / cSegmentChunks ] ) * cSegmentChunks + chunk % cSegmentChunks ]; }
+    
+    // Exchanges everything with another pool of the same size
+    void Swap( GenePool& other );
+    
+    // Recomputes the gene hash from its segments' hashes
+    void HashGene( Slot& slot );
+    
+    // Stores the given words as a chunk, or shares the chunk already holding them; the
+    // result carries a reference the caller has to release. StoreChunk() always stores,
+    // and leaves the chunk out of the lookup; AllocateChunk() too, leaving the words unset
+    uint32_t AddChunk( const int32_t* words, uint64_t chunkHash );
+    uint32_t StoreChunk( const int32_t* words, uint64_t chunkHash );
+    uint32_t AllocateChunk( uint64_t chunkHash );
+    void ReleaseChunk( uint32_t chunk );
+    void RemoveChunkFromLookup( uint32_t chunk );
+    
+    // Same for segments, given their chunks (whose references they take over)
+    uint32_t AddSegment( const uint32_t* chunks, uint64_t segmentHash );
+    uint32_t StoreSegment( const uint32_t* chunks, uint64_t segmentHash );
+    void ReleaseSegment( uint32_t storedSegment );
+    void RemoveSegmentFromLookup( uint32_t storedSegment );
+    
+    // Puts a stored segment (whose reference it takes over) into a slot, releasing the old one
+    void SetSegment( Slot& slot, int segment, uint32_t storedSegment );
+    
+    // The slot's stored segment, copied first if anybody else holds it, ready to be edited
+    uint32_t GetEditableSegment( Slot& slot, int segment );
+    
+    // Chunk storage grows cBlockChunks chunks at a time, and never moves
+    static const int cBlockChunks = 4096;
+    int32_t* GetChunkWords( uint32_t chunk ) const { return m_chunkBlocks[ chunk / cBlockChunks ] + size_t( chunk % cBlockChunks ) * cChunkWords; }
+    
+    std::vector< Slot > m_slots;
+    std::vector< uint32_t > m_segmentTables;
+    
+    // Every stored segment's chunks, references and hash, the same way as chunks below
+    std::vector< uint32_t > m_segmentChunks;
+    std::vector< uint32_t > m_segmentRefCounts;
+    std::vector< uint64_t > m_segmentHashes;
+    std::vector< bool > m_isSegmentLookedUp;
+    std::vector< uint32_t > m_freeSegments;
+    std::unordered_map< uint64_t, uint32_t > m_segmentLookup;
+    
+    // Every chunk's words, references and hash, unused ones on the free list; the lookup
+    // finds a stored chunk by hash (collisions just go unshared). Only whole genes coming in
+    // are looked up; edited chunks are almost always new, and breeding shares by reference
+    std::vector< int32_t* > m_chunkBlocks;
+    std::vector< uint32_t > m_chunkRefCounts;
+    std::vector< uint64_t > m_chunkHashes;
+    std::vector< bool > m_isChunkLookedUp;
+    std::vector< uint32_t > m_freeChunks;
+    std::unordered_map< uint64_t, uint32_t > m_chunkLookup;
+};
+
+#endif
@@ -0,0 +1,114 @@
+//
+//  IslandExchange.cpp
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+
+#include "IslandExchange.h"
+#include "GenePool.h"
+
+#include <string.h>
+#include <new>
+#include <sys/mman.h>
+
+IslandExchange::IslandExchange( int islandCount )
+    : m_islandCount( std::max( 1, islandCount ) )
+    , m_mapping( NULL )
+    , m_receivedSequences( m_islandCount, 0 )
+{
+    // Shared pages survive fork() as the same memory in every process, and come back zeroed
+    void* mapping = mmap( NULL, cOutboxSize * m_islandCount, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0 );
+    if( mapping == MAP_FAILED )
+    {
+        printf( "Internal error: unable to allocate an exchange for %d islands\n", m_islandCount );
+        return;
+    }
+    
+    m_mapping = mapping;
+    for( int i = 0; i < m_islandCount; i++ )
+    {
+        Outbox* outbox = new( &GetOutbox( i ) ) Outbox;
+        outbox->m_sequence.store( 0 );
+        outbox->m_geneCount = 0;
+    }
+}
+
+IslandExchange::~IslandExchange()
+{
+    if( m_mapping != NULL )
+    {
+        munmap( m_mapping, cOutboxSize * m_islandCount );
+    }
+}
+
+void IslandExchange::Publish( int islandIndex, const GenePool& genePool, const std::vector< int >& geneIndices )
+{
+    if( m_mapping == NULL )
+    {
+        return;
+    }
+    
+    // Odd while writing
+    Outbox& outbox = GetOutbox( islandIndex );
+    const uint32_t sequence = outbox.m_sequence.load( std::memory_order_relaxed );
+    outbox.m_sequence.store( sequence + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    
+    const int geneCount = std::min( int( geneIndices.size() ), int( cMigrantCount ) );
+    for( int i = 0; i < geneCount; i++ )
+    {
+        genePool.ReadGene( geneIndices[ i ], GetMigrant( islandIndex, i ) );
+    }
+    outbox.m_geneCount = uint32_t( geneCount );
+    
+    outbox.m_sequence.store( sequence + 2, std::memory_order_release );
+}
+
+int IslandExchange::Receive( int islandIndex, GenePool& genePool, const std::vector< int >& geneIndices )
+{
+    if( m_mapping == NULL || m_islandCount < 2 )
+    {
+        return 0;
+    }
+    
+    const int neighborIndex = ( islandIndex + m_islandCount - 1 ) % m_islandCount;
+    Outbox& outbox = GetOutbox( neighborIndex );
+    
+    // Copy out, then make sure no write started in the meantime; a write takes far less
+    // than a generation, so a few tries are plenty, and otherwise it waits for next time
+    const int cMaxTryCount = 8;
+    for( int tryIndex = 0; tryIndex < cMaxTryCount; tryIndex++ )
+    {
+        const uint32_t sequence = outbox.m_sequence.load( std::memory_order_acquire );
+        if( sequence == m_receivedSequences[ islandIndex ] )
+        {
+            return 0;
+        }
+        if( ( sequence & 1 ) != 0 )
+        {
+            continue;
+        }
+        
+        const int geneCount = std::min( int( geneIndices.size() ), int( outbox.m_geneCount ) );
+        m_buffer.resize( size_t( cMemorySize ) * geneCount );
+        if( geneCount > 0 )
+        {
+            memcpy( (void*)&m_buffer[ 0 ], (const void*)GetMigrant( neighborIndex, 0 ), sizeof( int32_t ) * cMemorySize * geneCount );
+        }
+        
+        std::atomic_thread_fence( std::memory_order_acquire );
+        if( outbox.m_sequence.load( std::memory_order_relaxed ) != sequence )
+        {
+            continue;
+        }
+        
+        m_receivedSequences[ islandIndex ] = sequence;
+        for( int i = 0; i < geneCount; i++ )
+        {
+            genePool.SetGene( geneIndices[ i ], &m_buffer[ size_t( cMemorySize ) * i ] );
+        }
+        return geneCount;
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+//
+//  IslandExchange.h
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+// Migration between island populations running as separate processes. The
+// exchange is a shared mapping made before the islands are forked: every
+// island has an outbox of cMigrantCount gene slots that only it writes, and
+// reads its neighbor's (the islands form a ring). Nobody ever waits for
+// anybody; an island simply picks up whatever its neighbor published last,
+// if that is newer than what it picked up before.
+//
+// Outboxes are guarded by a sequence count that is odd while a write is in
+// progress, so a reader that raced a write sees it and tries again.
+
+#ifndef __ISLANDEXCHANGE_H__
+#define __ISLANDEXCHANGE_H__
+
+#include "SimSnake.h"
+
+#include <atomic>
+
+class GenePool;
+
+class IslandExchange
+{
+public:
+    
+    // Genes every island sends per migration
+    static const int cMigrantCount = 4;
+    
+    // Must be created before forking, so every island shares it
+    IslandExchange( int islandCount );
+    ~IslandExchange();
+    
+    bool IsValid() const { return m_mapping != NULL; }
+    int GetIslandCount() const { return m_islandCount; }
+    
+    // Copies the given genes (up to cMigrantCount) into the island's outbox
+    void Publish( int islandIndex, const GenePool& genePool, const std::vector< int >& geneIndices );
+    
+    // Copies the neighbor's latest migrants over the given genes; returns the number
+    // of genes replaced, 0 if the neighbor has not published anything new since
+    int Receive( int islandIndex, GenePool& genePool, const std::vector< int >& geneIndices );
+
+private:
+    
+    // Outbox header, padded out to a page so gene slots stay page-aligned
+    struct Outbox
+    {
+        std::atomic< uint32_t > m_sequence;
+        uint32_t m_geneCount;
+    };
+    
+    static const size_t cOutboxHeaderSize = 4096;
+    static const size_t cOutboxSize = cOutboxHeaderSize + sizeof( int32_t ) * cMemorySize * cMigrantCount;
+    
+    Outbox& GetOutbox( int islandIndex ) const { return *(Outbox*)( (char*)m_mapping + cOutboxSize * islandIndex ); }
+    int32_t* GetMigrant( int islandIndex, int migrantIndex ) const { return (int32_t*)( (char*)m_mapping + cOutboxSize * islandIndex + cOutboxHeaderSize ) + cMemorySize * migrantIndex; }
+    
+    int m_islandCount;
+    void* m_mapping;
+    
+    // Last neighbor sequence received, per island; only ever used by the island's own process
+    std::vector< uint32_t > m_receivedSequences;
+    
+    // Where migrants are read to before they are known to be whole
+    std::vector< int32_t > m_buffer;
+};
+
+#endif
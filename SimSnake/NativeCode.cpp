@@ -0,0 +1,472 @@
+//
+//  NativeCode.cpp
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+
+#include "NativeCode.h"
+#include "CodeCache.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <mutex>
+
+#if defined( __x86_64__ )
+    #include <sys/mman.h>
+    #include <unistd.h>
+    #define __NativeCodeEnabled__
+#endif
+
+bool NativeCodeArena::s_isEnabled = true;
+
+#ifdef __NativeCodeEnabled__
+
+namespace
+{
+    // Mappings are recycled between arenas, so a simulation does not pay for mapping its own
+    std::mutex s_freeMappingsLock;
+    std::vector< std::pair< uint8_t*, uint8_t* > > s_freeMappings;
+    
+    const size_t cPageSize = 4096;
+    
+    // Worst case bytes emitted per op, plus the prologue and exits
+    const int cMaxPrologueBytes = 16;
+    const int cMaxOpBytes = 24;
+    const int cMaxExitBytes = 96;
+    
+    // Register use: rdi = NativeState*, rsi = memory, eax = register A, ecx = register B,
+    // r8d = budget, edx is scratch. All of them are caller-saved, so there is no frame to set up
+    class Emitter
+    {
+    public:
+        
+        Emitter( uint8_t* buffer ) : m_buffer( buffer ), m_size( 0 ) { }
+        
+        int GetSize() const { return m_size; }
+        
+        void Byte( uint8_t value ) { m_buffer[ m_size++ ] = value; }
+        void Bytes( uint8_t a, uint8_t b ) { Byte( a ); Byte( b ); }
+        void Bytes( uint8_t a, uint8_t b, uint8_t c ) { Byte( a ); Byte( b ); Byte( c ); }
+        
+        void Int32( int32_t value )
+        {
+            memcpy( m_buffer + m_size, &value, sizeof( value ) );
+            m_size += sizeof( value );
+        }
+        
+        // Patches a rel32 field (just emitted at the given offset) to land on target
+        void PatchRel32( int fieldOffset, int target )
+        {
+            const int32_t displacement = target - ( fieldOffset + 4 );
+            memcpy( m_buffer + fieldOffset, &displacement, sizeof( displacement ) );
+        }
+        
+        // mov eax, [rdi + offset] / mov ecx, ...
+        void LoadA( int offset ) { Bytes( 0x8B, 0x47, uint8_t( offset ) ); }
+        void LoadB( int offset ) { Bytes( 0x8B, 0x4F, uint8_t( offset ) ); }
+        
+        // mov [rdi + offset], eax / ecx
+        void StoreA( int offset ) { Bytes( 0x89, 0x47, uint8_t( offset ) ); }
+        void StoreB( int offset ) { Bytes( 0x89, 0x4F, uint8_t( offset ) ); }
+        
+        // mov eax, imm32 / mov ecx, imm32
+        void SetA( int32_t value ) { Byte( 0xB8 ); Int32( value ); }
+        void SetB( int32_t value ) { Byte( 0xB9 ); Int32( value ); }
+        
+        // eax = ( eax <cc> ecx ), with cc one of the setcc opcodes
+        void Compare( uint8_t setccOpcode )
+        {
+            Bytes( 0x39, 0xC8 );                // cmp eax, ecx
+            Bytes( 0x0F, setccOpcode, 0xC0 );   // setcc al
+            Bytes( 0x0F, 0xB6, 0xC0 );          // movzx eax, al
+        }
+        
+        // Returns 0 (the whole block ran), with execution continuing at the given address
+        void ExitTo( int32_t instructionPtr )
+        {
+            Bytes( 0x44, 0x89, 0x47 );          // mov [rdi + m_budget], r8d
+            Byte( uint8_t( offsetof( NativeState, m_budget ) ) );
+            Bytes( 0xC7, 0x47, uint8_t( offsetof( NativeState, m_instructionPtr ) ) );
+            Int32( instructionPtr );
+            Bytes( 0x31, 0xC0 );                // xor eax, eax
+            Byte( 0xC3 );                       // ret
+        }
+        
+        void StoreRegisters()
+        {
+            StoreA( offsetof( NativeState, m_registerA ) );
+            StoreB( offsetof( NativeState, m_registerB ) );
+        }
+        
+    private:
+        
+        uint8_t* m_buffer;
+        int m_size;
+    };
+    
+    // setcc opcodes, in the same order as cInstruction_Equal .. cInstruction_GTE
+    const uint8_t cCompareSetcc[] = { 0x94, 0x95, 0x9C, 0x9F, 0x9E, 0x9D };
+    
+    // Translates one op; returns false for ops that need the interpreter
+    bool EmitOp( Emitter& emitter, const DecodedOp& op )
+    {
+        const int32_t kind = op.m_kind;
+        
+        if( kind >= cInstruction_Equal && kind <= cInstruction_GTE )
+        {
+            emitter.Compare( cCompareSetcc[ kind - cInstruction_Equal ] );
+            return true;
+        }
+        
+        if( kind >= cDecoded_SetBEqual && kind <= cDecoded_SetBGTE )
+        {
+            emitter.SetB( op.m_arg0 );
+            emitter.Compare( cCompareSetcc[ kind - cDecoded_SetBEqual ] );
+            return true;
+        }
+        
+        if( kind >= cDecoded_GetPosSetBEqual && kind <= cDecoded_GetPosSetBGTE )
+        {
+            emitter.SetB( op.m_arg0 );
+            emitter.LoadA( offsetof( NativeState, m_headX ) );
+            emitter.Compare( cCompareSetcc[ kind - cDecoded_GetPosSetBEqual ] );
+            return true;
+        }
+        
+        switch( kind )
+        {
+            case cInstruction_Nop:
+                return true;
+                
+            case cInstruction_ZeroA:
+                emitter.Bytes( 0x31, 0xC0 );            // xor eax, eax
+                return true;
+                
+            case cInstruction_ZeroB:
+                emitter.Bytes( 0x31, 0xC9 );            // xor ecx, ecx
+                return true;
+                
+            case cInstruction_GetPos:
+                emitter.LoadA( offsetof( NativeState, m_headX ) );
+                emitter.LoadB( offsetof( NativeState, m_headY ) );
+                return true;
+                
+            case cDecoded_GetPosSwap:
+                emitter.LoadA( offsetof( NativeState, m_headY ) );
+                emitter.LoadB( offsetof( NativeState, m_headX ) );
+                return true;
+                
+            case cInstruction_BSize:
+                emitter.LoadA( offsetof( NativeState, m_boardSize ) );
+                return true;
+                
+            case cInstruction_SetA:
+                emitter.SetA( op.m_arg0 );
+                return true;
+                
+            case cInstruction_SetB:
+                emitter.SetB( op.m_arg0 );
+                return true;
+                
+            case cInstruction_Swap:
+                emitter.Byte( 0x91 );                   // xchg eax, ecx
+                return true;
+                
+            // Out-of-bounds reads leave the register alone, same as the interpreter
+            case cInstruction_ReadA:
+                emitter.Byte( 0x3D );                   // cmp eax, cMemorySize
+                emitter.Int32( cMemorySize );
+                emitter.Bytes( 0x73, 0x03 );            // jae +3
+                emitter.Bytes( 0x8B, 0x04, 0x86 );      // mov eax, [rsi + rax * 4]
+                return true;
+                
+            case cInstruction_ReadB:
+                emitter.Bytes( 0x81, 0xF9 );            // cmp ecx, cMemorySize
+                emitter.Int32( cMemorySize );
+                emitter.Bytes( 0x73, 0x03 );            // jae +3
+                emitter.Bytes( 0x8B, 0x0C, 0x8E );      // mov ecx, [rsi + rcx * 4]
+                return true;
+                
+            // The address is known up front
+            case cDecoded_SetAReadA:
+                if( op.m_arg0 >= 0 && op.m_arg0 < cMemorySize )
+                {
+                    emitter.Bytes( 0x8B, 0x86 );        // mov eax, [rsi + disp32]
+                    emitter.Int32( op.m_arg0 * 4 );
+                }
+                else
+                {
+                    emitter.SetA( op.m_arg0 );
+                }
+                return true;
+                
+            case cDecoded_SetBReadB:
+                if( op.m_arg0 >= 0 && op.m_arg0 < cMemorySize )
+                {
+                    emitter.Bytes( 0x8B, 0x8E );        // mov ecx, [rsi + disp32]
+                    emitter.Int32( op.m_arg0 * 4 );
+                }
+                else
+                {
+                    emitter.SetB( op.m_arg0 );
+                }
+                return true;
+                
+            case cInstruction_Add:
+                emitter.Bytes( 0x01, 0xC8 );            // add eax, ecx
+                return true;
+                
+            case cInstruction_Sub:
+                emitter.Bytes( 0x29, 0xC8 );            // sub eax, ecx
+                return true;
+                
+            case cInstruction_Mul:
+                emitter.Bytes( 0x0F, 0xAF, 0xC1 );      // imul eax, ecx
+                return true;
+                
+            case cInstruction_And:
+                emitter.Bytes( 0x85, 0xC0 );            // test eax, eax
+                emitter.Bytes( 0x0F, 0x95, 0xC0 );      // setne al
+                emitter.Bytes( 0x85, 0xC9 );            // test ecx, ecx
+                emitter.Bytes( 0x0F, 0x95, 0xC2 );      // setne dl
+                emitter.Bytes( 0x20, 0xD0 );            // and al, dl
+                emitter.Bytes( 0x0F, 0xB6, 0xC0 );      // movzx eax, al
+                return true;
+                
+            case cInstruction_Or:
+                emitter.Bytes( 0x09, 0xC8 );            // or eax, ecx
+                emitter.Bytes( 0x0F, 0x95, 0xC0 );      // setne al
+                emitter.Bytes( 0x0F, 0xB6, 0xC0 );      // movzx eax, al
+                return true;
+                
+            case cInstruction_Not:
+                emitter.Bytes( 0x85, 0xC0 );            // test eax, eax
+                emitter.Bytes( 0x0F, 0x94, 0xC0 );      // sete al
+                emitter.Bytes( 0x0F, 0xB6, 0xC0 );      // movzx eax, al
+                return true;
+                
+            default:
+                return false;
+        }
+    }
+    
+    // Loops back to the start of the block if the budget allows another pass, otherwise falls through
+    void EmitLoop( Emitter& emitter, int bodyOffset, int32_t instructionCount )
+    {
+        emitter.Bytes( 0x44, 0x89, 0xC2 );              // mov edx, r8d
+        emitter.Bytes( 0x81, 0xEA );                    // sub edx, instructionCount
+        emitter.Int32( instructionCount );
+        emitter.Bytes( 0x0F, 0x8C );                    // jl exit
+        const int exitField = emitter.GetSize();
+        emitter.Int32( 0 );
+        emitter.Bytes( 0x41, 0x89, 0xD0 );              // mov r8d, edx
+        emitter.Byte( 0xE9 );                           // jmp body
+        emitter.Int32( 0 );
+        emitter.PatchRel32( emitter.GetSize() - 4, bodyOffset );
+        emitter.PatchRel32( exitField, emitter.GetSize() );
+    }
+}
+
+NativeCodeArena::NativeCodeArena()
+    : m_code( NULL )
+    , m_writableCode( NULL )
+    , m_usedSize( 0 )
+{
+}
+
+NativeCodeArena::~NativeCodeArena()
+{
+    if( m_code != NULL )
+    {
+        ReleaseMapping();
+    }
+}
+
+bool NativeCodeArena::AcquireMapping()
+{
+    {
+        std::lock_guard< std::mutex > lock( s_freeMappingsLock );
+        if( !s_freeMappings.empty() )
+        {
+            m_code = s_freeMappings.back().first;
+            m_writableCode = s_freeMappings.back().second;
+            s_freeMappings.pop_back();
+            return true;
+        }
+    }
+    
+    #if defined( __linux__ )
+    
+        // The same pages mapped twice, once writable and once executable
+        const int fileHandle = memfd_create( "SimSnake", MFD_CLOEXEC );
+        if( fileHandle >= 0 && ftruncate( fileHandle, cArenaSize ) == 0 )
+        {
+            void* writable = mmap( NULL, cArenaSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileHandle, 0 );
+            void* executable = mmap( NULL, cArenaSize, PROT_READ | PROT_EXEC, MAP_SHARED, fileHandle, 0 );
+            close( fileHandle );
+            
+            if( writable != MAP_FAILED && executable != MAP_FAILED )
+            {
+                m_code = (uint8_t*)executable;
+                m_writableCode = (uint8_t*)writable;
+                return true;
+            }
+            
+            if( writable != MAP_FAILED )
+            {
+                munmap( writable, cArenaSize );
+            }
+            if( executable != MAP_FAILED )
+            {
+                munmap( executable, cArenaSize );
+            }
+            return false;
+        }
+        
+        if( fileHandle >= 0 )
+        {
+            close( fileHandle );
+        }
+    
+    #endif
+    
+    // Single mapping, flipped to writable around every copy
+    void* mapping = mmap( NULL, cArenaSize, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( mapping == MAP_FAILED )
+    {
+        return false;
+    }
+    m_code = (uint8_t*)mapping;
+    m_writableCode = NULL;
+    return true;
+}
+
+void NativeCodeArena::ReleaseMapping()
+{
+    std::lock_guard< std::mutex > lock( s_freeMappingsLock );
+    s_freeMappings.push_back( std::make_pair( m_code, m_writableCode ) );
+}
+
+NativeBlock NativeCodeArena::Compile( const DecodedBlock& block, const DecodedOp* ops )
+{
+    // Emitted into a local buffer first, then copied into the arena
+    uint8_t buffer[ cMaxPrologueBytes + ( CodeCache::cMaxBlockOps + 1 ) * cMaxOpBytes + cMaxExitBytes ];
+    Emitter emitter( buffer );
+    
+    emitter.LoadA( offsetof( NativeState, m_registerA ) );
+    emitter.LoadB( offsetof( NativeState, m_registerB ) );
+    emitter.Bytes( 0x48, 0x8B, 0x77 );                  // mov rsi, [rdi + m_memory]
+    emitter.Byte( uint8_t( offsetof( NativeState, m_memory ) ) );
+    emitter.Bytes( 0x44, 0x8B, 0x47 );                  // mov r8d, [rdi + m_budget]
+    emitter.Byte( uint8_t( offsetof( NativeState, m_budget ) ) );
+    const int bodyOffset = emitter.GetSize();
+    
+    int opIndex = 0;
+    while( EmitOp( emitter, ops[ opIndex ] ) )
+    {
+        opIndex++;
+    }
+    
+    const DecodedOp& lastOp = ops[ opIndex ];
+    const int32_t jumpTarget = int32_t( uint32_t( lastOp.m_nextAddress ) - 2 + uint32_t( lastOp.m_arg0 ) );
+    
+    if( lastOp.m_kind == cDecoded_Next )
+    {
+        emitter.StoreRegisters();
+        emitter.ExitTo( lastOp.m_nextAddress );
+    }
+    else if( lastOp.m_kind == cInstruction_Jmp )
+    {
+        if( jumpTarget == block.m_address )
+        {
+            EmitLoop( emitter, bodyOffset, block.m_instructionCount );
+        }
+        emitter.StoreRegisters();
+        emitter.ExitTo( jumpTarget );
+    }
+    else if( lastOp.m_kind == cInstruction_IfJmp )
+    {
+        emitter.Bytes( 0x85, 0xC0 );                    // test eax, eax
+        emitter.Bytes( 0x0F, 0x84 );                    // jz not taken
+        const int notTakenField = emitter.GetSize();
+        emitter.Int32( 0 );
+        
+        if( jumpTarget == block.m_address )
+        {
+            EmitLoop( emitter, bodyOffset, block.m_instructionCount );
+        }
+        emitter.StoreRegisters();
+        emitter.ExitTo( jumpTarget );
+        
+        emitter.PatchRel32( notTakenField, emitter.GetSize() );
+        emitter.StoreRegisters();
+        emitter.ExitTo( lastOp.m_nextAddress );
+    }
+    else if( opIndex > 0 )
+    {
+        // Stopped short; the interpreter carries on from this op
+        emitter.StoreRegisters();
+        emitter.SetA( opIndex );
+        emitter.Byte( 0xC3 );                           // ret
+    }
+    else
+    {
+        return NULL;
+    }
+    
+    if( m_code == NULL && !AcquireMapping() )
+    {
+        return NULL;
+    }
+    
+    if( m_usedSize + emitter.GetSize() > cArenaSize )
+    {
+        return NULL;
+    }
+    
+    uint8_t* code = m_code + m_usedSize;
+    if( m_writableCode != NULL )
+    {
+        memcpy( (void*)( m_writableCode + m_usedSize ), buffer, emitter.GetSize() );
+    }
+    else
+    {
+        // Never writable and executable at the same time; only the pages being written are flipped
+        uint8_t* firstPage = m_code + ( m_usedSize & ~( cPageSize - 1 ) );
+        const size_t pageRangeSize = ( code + emitter.GetSize() ) - firstPage;
+        if( mprotect( (void*)firstPage, pageRangeSize, PROT_READ | PROT_WRITE ) != 0 )
+        {
+            return NULL;
+        }
+        memcpy( (void*)code, buffer, emitter.GetSize() );
+        if( mprotect( (void*)firstPage, pageRangeSize, PROT_READ | PROT_EXEC ) != 0 )
+        {
+            return NULL;
+        }
+    }
+    
+    // Keep entry points 16-byte aligned
+    m_usedSize += ( emitter.GetSize() + 15 ) & ~size_t( 15 );
+    return (NativeBlock)code;
+}
+
+#else
+
+NativeCodeArena::NativeCodeArena()
+    : m_code( NULL )
+    , m_writableCode( NULL )
+    , m_usedSize( 0 )
+{
+}
+
+NativeCodeArena::~NativeCodeArena()
+{
+}
+
+NativeBlock NativeCodeArena::Compile( const DecodedBlock& block, const DecodedOp* ops )
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,87 @@
+//
+//  NativeCode.h
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+// Translates hot decoded blocks into native x86-64 code. Only instructions
+// that touch nothing but the registers and a read of memory are translated;
+// a block is translated up to its first other instruction (Board, Write,
+// Div, Mod, or a move), and the interpreter picks up from there, so division
+// and board reads get the interpreter's checks. Translated code never writes
+// memory, so self-modifying writes simply invalidate the block in the
+// CodeCache and execution falls back to freshly decoded code.
+//
+// A block that jumps back to its own start loops natively, but only while
+// its instruction budget lasts, so the stall limit stays exact.
+//
+// On anything other than x86-64, nothing gets translated.
+
+#ifndef __NATIVECODE_H__
+#define __NATIVECODE_H__
+
+#include "SimSnake.h"
+
+struct DecodedOp;
+struct DecodedBlock;
+
+// Everything translated code reads or writes
+struct NativeState
+{
+    int32_t m_registerA;
+    int32_t m_registerB;
+    
+    // Snake head, for GetPos
+    int32_t m_headX;
+    int32_t m_headY;
+    int32_t m_boardSize;
+    
+    // In: instructions that may still run after the current pass through the
+    // block; out: what is left of it after looping
+    int32_t m_budget;
+    
+    // Out: where execution continues once the whole block ran
+    int32_t m_instructionPtr;
+    
+    const int32_t* m_memory;
+};
+
+// Returns 0 once the whole block ran, otherwise the index of the first op left for the interpreter
+typedef int32_t (*NativeBlock)( NativeState* state );
+
+class NativeCodeArena
+{
+public:
+    
+    NativeCodeArena();
+    ~NativeCodeArena();
+    
+    // Translates as much of the block as possible; NULL if not even its first op could be
+    NativeBlock Compile( const DecodedBlock& block, const DecodedOp* ops );
+    
+    // Drop all translated code
+    void Clear() { m_usedSize = 0; }
+    
+    // Translation is on by default; turning it off leaves every block to the interpreter,
+    // for comparing the two. Only change it while no game is running
+    static bool IsEnabled() { return s_isEnabled; }
+    static void SetEnabled( bool isEnabled ) { s_isEnabled = isEnabled; }
+    
+private:
+    
+    // Executable memory, mapped on first use; once full, nothing more is translated until cleared
+    static const size_t cArenaSize = 1024 * 1024;
+    
+    // Mappings outlive their arena and are handed to the next one
+    bool AcquireMapping();
+    void ReleaseMapping();
+    
+    // Executable view, and (where supported) a separate writable view of the same pages
+    uint8_t* m_code;
+    uint8_t* m_writableCode;
+    size_t m_usedSize;
+    
+    static bool s_isEnabled;
+};
+
+#endif
@@ -0,0 +1,67 @@
+//
+//  RandomStream.h
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+// Counter-based random numbers: the n-th value of a stream is a hash of the
+// stream's key and n, so there is no shared state between streams and any
+// stream can be started over or re-created from the numbers that named it.
+// Every game and every bred child gets its own stream, keyed by the run's
+// seed, the generation and the gene index, which keeps results the same no
+// matter how many threads evaluate them or in which order.
+
+#ifndef __RANDOMSTREAM_H__
+#define __RANDOMSTREAM_H__
+
+#include <stdint.h>
+
+// What a stream is used for; part of its key, so uses never share numbers
+enum RandomStreamKind
+{
+    cRandomStream_Game,
+    cRandomStream_Breed,
+    cRandomStream_Padding,
+    cRandomStream_SteadyState,
+};
+
+class RandomStream
+{
+public:
+    
+    // Named by a seed and up to three more numbers, e.g. kind, generation and gene index
+    explicit RandomStream( uint64_t seed = 0, uint64_t a = 0, uint64_t b = 0, uint64_t c = 0 )
+        : m_key( Mix( Mix( Mix( Mix( seed ) ^ a ) ^ b ) ^ c ) )
+        , m_counter( 0 )
+    {
+    }
+    
+    // Back to the first value
+    void Rewind() { m_counter = 0; }
+    
+    // Uniform over all 32-bit values
+    uint32_t Next() { return uint32_t( Mix( m_key + cGolden * ++m_counter ) >> 32 ); }
+    
+    // Uniform over [0, limit), limit must be positive
+    int NextInt( int limit ) { return int( ( uint64_t( Next() ) * uint32_t( limit ) ) >> 32 ); }
+    
+    // Uniform over [0, INT32_MAX], same range as rand()
+    int32_t NextWord() { return int32_t( Next() >> 1 ); }
+    
+    // SplitMix64 finalizer; also a good enough 64-bit hash
+    static uint64_t Mix( uint64_t value )
+    {
+        value = ( value ^ ( value >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+        value = ( value ^ ( value >> 27 ) ) * 0x94D049BB133111EBull;
+        return value ^ ( value >> 31 );
+    }
+
+private:
+    
+    static const uint64_t cGolden = 0x9E3779B97F4A7C15ull;
+    
+    uint64_t m_key;
+    uint64_t m_counter;
+};
+
+#endif
@@ -7,12 +7,20 @@
 //
 
 #include "SimSnake.h"
+#include "GenePool.h"
+#include "IslandExchange.h"
+#include "EvaluationFarm.h"
+#include "CodeCache.h"
+#include "WorkScheduler.h"
 
 #include <stdlib.h>
 #include <limits.h>
 #include <ctype.h>
+#include <string.h>
 #include <string>
 #include <map>
+#include <thread>
+#include <atomic>
 
 /*** Helper Functions ***/
 
@@ -43,38 +51,62 @@ namespace
     
     bool GeneFitnessSortFunc( const SimSnake::GeneFitnessPair& a, const SimSnake::GeneFitnessPair& b )
     {
+        if( a.m_roundCount != b.m_roundCount )
+        {
+            return a.m_roundCount > b.m_roundCount;
+        }
         return a.m_fitnessValue < b.m_fitnessValue;
     }
     
-    void GetGeneName( int geneIndex, char* geneNameOut )
+    // Register arithmetic wraps around, as it does in native code; it is done unsigned, since
+    // signed overflow is undefined
+    inline int32_t AddWords( int32_t a, int32_t b )
+    {
+        return int32_t( uint32_t( a ) + uint32_t( b ) );
+    }
+    
+    inline int32_t SubtractWords( int32_t a, int32_t b )
+    {
+        return int32_t( uint32_t( a ) - uint32_t( b ) );
+    }
+    
+    inline int32_t MultiplyWords( int32_t a, int32_t b )
     {
-        sprintf( geneNameOut, "Gene%d", geneIndex );
+        return int32_t( uint32_t( a ) * uint32_t( b ) );
+    }
+    
+    // Division and remainder for a non-zero divisor; INT_MIN / -1 would trap, so dividing
+    // by -1 wraps around like the rest
+    inline int32_t DivideWords( int32_t a, int32_t b )
+    {
+        return ( b == -1 ) ? int32_t( 0u - uint32_t( a ) ) : ( a / b );
+    }
+    
+    inline int32_t ModuloWords( int32_t a, int32_t b )
+    {
+        return ( b == -1 ) ? 0 : ( a % b );
     }
 }
 
 
 
 // Serialize to text file
-bool WriteGene( const char* fileName, const Gene& gene )
+bool WriteGene( const char* fileName, const Gene& gene, uint64_t randomSeed )
 {
     FILE* file = NULL;
     if( (file = fopen( fileName, "wb" )) != NULL )
     {
-        const size_t instructionCount = gene.size();
-        for( int i = 0; i < instructionCount; i++ )
-        {
-            fwrite( (void*)&gene[ i ], sizeof( Instruction ), 1, file );
-        }
-        
-        // Fill rest with random numbers
-        for( size_t i = instructionCount; i < (size_t)std::max( (int)instructionCount,  cMemorySize ); i++ )
+        // Fill rest with random numbers; written out in one go with the gene
+        Gene paddedGene( gene );
+        RandomStream random( randomSeed, cRandomStream_Padding );
+        for( size_t i = gene.size(); i < (size_t)cMemorySize; i++ )
         {
-            int random = rand() % INT_MAX;
-            fwrite( (void*)&(random), sizeof( Instruction ), 1, file );
+            paddedGene.push_back( random.NextWord() );
         }
         
+        bool success = paddedGene.empty() || ( fwrite( (const void*)&paddedGene[ 0 ], sizeof( int32_t ), paddedGene.size(), file ) == paddedGene.size() );
         fclose( file );
-        return true;
+        return success;
     }
     return false;
 }
@@ -82,37 +114,18 @@ bool WriteGene( const char* fileName, const Gene& gene )
 bool LoadGene( const char* fileName, Gene& gene )
 {
     FILE* file = NULL;
-    if( (file = fopen( fileName, "r" )) != NULL )
+    if( (file = fopen( fileName, "rb" )) != NULL )
     {
-        bool success = false;
-        Instruction instruction;
-        
-        // Keep moving at length of instructions; warning, this makes
+        // Whole words only; a trailing partial word is ignored. Warning, this makes
         // this code saved files not portal when different systems have different word-sizes
-        for( int i = 0; i < INT_MAX; i++ )
-        {
-            size_t read = fread( (void*)&instruction, sizeof( Instruction ), 1, file );
-            
-            // End of file
-            if( read == 0 )
-            {
-                success = true;
-                break;
-            }
-            
-            // Read more or less than expected, bad
-            else if( read != 1 )
-            {
-                success = false;
-                break;
-            }
-            
-            // Else push instruction
-            else
-            {
-                gene.push_back( instruction );
-            }
-        }
+        fseek( file, 0, SEEK_END );
+        const size_t wordCount = size_t( ftell( file ) ) / sizeof( int32_t );
+        fseek( file, 0, SEEK_SET );
+        
+        const size_t offset = gene.size();
+        gene.resize( offset + wordCount );
+        
+        bool success = ( wordCount == 0 ) || ( fread( (void*)&gene[ offset ], sizeof( int32_t ), wordCount, file ) == wordCount );
         
         fclose( file );
         return success;
@@ -295,55 +308,319 @@ bool MapInstruction( const char* token, Instruction& instructionOut )
 /*** Board Simulation ***/
 
 
-BoardSimulation::BoardSimulation( int worldSize, const Gene& gene )
+BoardSimulation::BoardSimulation( int worldSize, const Gene& gene, const RandomStream& random )
+    : BoardSimulation( worldSize, gene.empty() ? NULL : &gene[ 0 ], (int)gene.size(), random )
+{
+}
+
+BoardSimulation::BoardSimulation( int worldSize, const int32_t* gene, int geneLength, const RandomStream& random )
+    : BoardSimulation( worldSize )
+{
+    Reset( gene, geneLength, random );
+}
+
+BoardSimulation::BoardSimulation( int worldSize, const GenePool& genePool, int geneIndex, const RandomStream& random )
+    : BoardSimulation( worldSize )
+{
+    Reset( genePool, geneIndex, random );
+}
+
+BoardSimulation::BoardSimulation( int worldSize )
     : m_memory( NULL )
-    , m_boardObjects( NULL )
+    , m_codeCache( NULL )
+    , m_loadedPool( NULL )
+    , m_loadedGeneIndex( 0 )
+    , m_loadedGene( NULL )
+    , m_loadedGeneLength( 0 )
+    , m_snakeCells( NULL )
+    , m_pelletCells( NULL )
     , m_instructionPtr( 0 )
     , m_boardSize( worldSize )
     , m_registerA( 0 )
     , m_registerB( 0 )
     , m_errorCode( cError_None )
+    , m_snakeBody( NULL )
+    , m_snakeHead( 0 )
+    , m_snakeLength( 0 )
+    , m_pelletIndices( NULL )
+    , m_freeCells( NULL )
+    , m_freeCellIndices( NULL )
+    , m_freeCellCount( 0 )
     , m_instructionCount( 0 )
     , m_movementCount( 0 )
     , m_pelletCount( 0 )
     , m_hungerCount( 0 )
+    , m_writeEpoch( 0 )
+    , m_isLoggingWrites( false )
+    , m_isWriteLogFull( false )
+    , m_historyPelletCount( 0 )
+    , m_record( NULL )
+    , m_readWords( NULL )
+{
+    // Memory is filled in by Reset(); cMemoryGuardCount zero words past the end let
+    // RunUntilMoved() read trailing arguments without a bounds check
+    m_memory = new int32_t[ cMemorySize + cMemoryGuardCount ];
+    memset( (void*)( m_memory + cMemorySize ), 0, sizeof( int32_t ) * cMemoryGuardCount );
+    m_loadedChunkHashes.resize( cMemorySize / GenePool::cChunkWords, 0 );
+    memset( (void*)m_dirtyPages, 0, sizeof( m_dirtyPages ) );
+    
+    // Decoded lazily as execution reaches code
+    m_codeCache = new CodeCache();
+    
+    // Board as bitboards; the snake can never be longer than the board has cells
+    const int boardWordCount = ( m_boardSize * m_boardSize + 63 ) / 64;
+    m_snakeCells = new uint64_t[ boardWordCount ];
+    m_pelletCells = new uint64_t[ boardWordCount ];
+    m_snakeBody = new BoardPosition[ m_boardSize * m_boardSize ];
+    m_pelletIndices = new int32_t[ m_boardSize * m_boardSize ];
+    m_freeCells = new int32_t[ m_boardSize * m_boardSize ];
+    m_freeCellIndices = new int32_t[ m_boardSize * m_boardSize ];
+}
+
+BoardSimulation::~BoardSimulation()
+{
+    delete[] m_memory;
+    delete m_codeCache;
+    delete[] m_snakeCells;
+    delete[] m_pelletCells;
+    delete[] m_snakeBody;
+    delete[] m_pelletIndices;
+    delete[] m_freeCells;
+    delete[] m_freeCellIndices;
+    delete[] m_readWords;
+}
+
+void BoardSimulation::Reset( const int32_t* gene, int geneLength, const RandomStream& random )
+{
+    // Copy in gene, set the rest to zero
+    const int instructionCount = std::max( 0, std::min( geneLength, cMemorySize ) );
+    if( instructionCount > 0 )
+    {
+        memcpy( (void*)m_memory, (const void*)gene, sizeof( int32_t ) * instructionCount );
+    }
+    memset( (void*)( m_memory + instructionCount ), 0, sizeof( int32_t ) * ( cMemorySize - instructionCount ) );
+    
+    m_loadedPool = NULL;
+    m_loadedGene = gene;
+    m_loadedGeneLength = instructionCount;
+    std::fill( m_loadedChunkHashes.begin(), m_loadedChunkHashes.end(), 0 );
+    m_random = random;
+    m_codeCache->Reset();
+    ResetState();
+}
+
+void BoardSimulation::Reset( const GenePool& genePool, int geneIndex, const RandomStream& random )
+{
+    static_assert( cDirtyPageWords % GenePool::cChunkWords == 0, "Dirty pages must be whole gene pool chunks" );
+    
+    // Chunks with the same hash hold the same words, so only chunks that differ, or
+    // that the last game wrote to, need copying
+    for( int chunk = 0; chunk < GenePool::cChunkCount; chunk++ )
+    {
+        const int32_t address = chunk * GenePool::cChunkWords;
+        const int page = address / cDirtyPageWords;
+        const bool isDirty = ( m_dirtyPages[ page >> 6 ] & ( uint64_t( 1 ) << ( page & 63 ) ) ) != 0;
+        
+        const uint64_t chunkHash = genePool.GetChunkHash( geneIndex, chunk );
+        if( isDirty || m_loadedChunkHashes[ chunk ] != chunkHash )
+        {
+            memcpy( (void*)( m_memory + address ), (const void*)genePool.GetChunk( geneIndex, chunk ), sizeof( int32_t ) * GenePool::cChunkWords );
+            m_loadedChunkHashes[ chunk ] = chunkHash;
+        }
+    }
+    
+    m_loadedPool = &genePool;
+    m_loadedGeneIndex = geneIndex;
+    m_loadedGene = NULL;
+    m_loadedGeneLength = cMemorySize;
+    m_random = random;
+    m_codeCache->Reset();
+    ResetState();
+}
+
+void BoardSimulation::Restart( const RandomStream& random )
 {
-    // Set all to zero, copy in gene
-    m_memory = new int32_t[ cMemorySize ];
-    memset( (void*)m_memory, 0, sizeof( int32_t ) * cMemorySize );
-    const int instructionCount = (int)gene.size();
-    for( int i = 0; i < instructionCount; i++ )
+    for( int page = 0; page < cMemorySize / cDirtyPageWords; page++ )
     {
-        m_memory[ i ] = gene[ i ];
+        if( ( m_dirtyPages[ page >> 6 ] & ( uint64_t( 1 ) << ( page & 63 ) ) ) == 0 )
+        {
+            continue;
+        }
+        
+        // Only words the game changed go back to what was loaded (a pool's chunk, or the
+        // given gene padded with zeroes); decoded code stays, except what was built from them
+        for( int32_t address = page * cDirtyPageWords; address < ( page + 1 ) * cDirtyPageWords; address += GenePool::cChunkWords )
+        {
+            const int loadedCount = ( m_loadedPool != NULL ) ? GenePool::cChunkWords : std::max( 0, std::min( int( GenePool::cChunkWords ), m_loadedGeneLength - address ) );
+            const int32_t* loadedWords = ( m_loadedPool != NULL ) ? m_loadedPool->GetChunk( m_loadedGeneIndex, address / GenePool::cChunkWords ) : m_loadedGene;
+            if( m_loadedPool == NULL && loadedCount > 0 )
+            {
+                loadedWords += address;
+            }
+            
+            for( int32_t i = 0; i < GenePool::cChunkWords; i++ )
+            {
+                const int32_t loadedValue = ( i < loadedCount ) ? loadedWords[ i ] : 0;
+                if( m_memory[ address + i ] != loadedValue )
+                {
+                    m_memory[ address + i ] = loadedValue;
+                    m_codeCache->Invalidate( address + i, loadedValue );
+                }
+            }
+        }
     }
     
+    m_random = random;
+    ResetState();
+}
+
+void BoardSimulation::ResetState()
+{
+    m_instructionPtr = 0;
+    m_registerA = 0;
+    m_registerB = 0;
+    m_errorCode = cError_None;
+    m_instructionCount = 0;
+    m_movementCount = 0;
+    m_pelletCount = 0;
+    m_hungerCount = 0;
+    m_random.Rewind();
+    m_isLoggingWrites = false;
+    m_writeLog.clear();
+    memset( (void*)m_dirtyPages, 0, sizeof( m_dirtyPages ) );
+    
     // Default board to nothing
-    m_boardObjects = new BoardObject[ m_boardSize * m_boardSize ];
-    memset( (void*)m_boardObjects, 0, sizeof( BoardObject ) * m_boardSize * m_boardSize );
+    const int boardWordCount = ( m_boardSize * m_boardSize + 63 ) / 64;
+    memset( (void*)m_snakeCells, 0, sizeof( uint64_t ) * boardWordCount );
+    memset( (void*)m_pelletCells, 0, sizeof( uint64_t ) * boardWordCount );
+    m_pellets.clear();
+    std::fill( m_pelletIndices, m_pelletIndices + m_boardSize * m_boardSize, -1 );
+    
+    // Every cell starts out free
+    for( int i = 0; i < m_boardSize * m_boardSize; i++ )
+    {
+        m_freeCells[ i ] = i;
+        m_freeCellIndices[ i ] = i;
+    }
+    m_freeCellCount = m_boardSize * m_boardSize;
     
     // Start at center
     BoardPosition pos( m_boardSize / 2, m_boardSize / 2 );
-    m_snake.push_back( pos );
+    m_snakeHead = 0;
+    m_snakeBody[ m_snakeHead ] = pos;
+    m_snakeLength = 1;
     SetBoard( pos.x, pos.y, cBoardObject_Snake );
     
     // Add a pellet
     AddPellet();
 }
 
-BoardSimulation::~BoardSimulation()
+void BoardSimulation::SetBoard( int x, int y, const BoardSimulation::BoardObject& boardObj )
 {
-    delete[] m_memory;
-    delete[] m_boardObjects;
+    const int cell = y * m_boardSize + x;
+    const uint64_t bit = uint64_t( 1 ) << ( cell & 63 );
+    uint64_t& snakeWord = m_snakeCells[ cell >> 6 ];
+    uint64_t& pelletWord = m_pelletCells[ cell >> 6 ];
+    
+    const bool wasFree = ( ( snakeWord | pelletWord ) & bit ) == 0;
+    const bool isFree = ( boardObj == cBoardObject_None );
+    snakeWord = ( boardObj == cBoardObject_Snake ) ? ( snakeWord | bit ) : ( snakeWord & ~bit );
+    pelletWord = ( boardObj == cBoardObject_Pellet ) ? ( pelletWord | bit ) : ( pelletWord & ~bit );
+    
+    if( wasFree && !isFree )
+    {
+        // Swap the last free cell into the hole
+        const int freeIndex = m_freeCellIndices[ cell ];
+        const int lastCell = m_freeCells[ --m_freeCellCount ];
+        m_freeCells[ freeIndex ] = lastCell;
+        m_freeCellIndices[ lastCell ] = freeIndex;
+        m_freeCellIndices[ cell ] = -1;
+    }
+    else if( !wasFree && isFree )
+    {
+        m_freeCellIndices[ cell ] = m_freeCellCount;
+        m_freeCells[ m_freeCellCount++ ] = cell;
+    }
 }
 
-BoardSimulation::BoardObject BoardSimulation::GetBoard( int x, int y ) const
+inline bool BoardSimulation::WriteMemory( int32_t address, int32_t value )
 {
-    return m_boardObjects[y * m_boardSize + x];
+    if( m_record != NULL )
+    {
+        if( m_record->m_writes.size() < size_t( cMaxRecordedWriteCount ) )
+        {
+            GameRecord::MemoryWrite write = { address, value };
+            m_record->m_writes.push_back( write );
+        }
+        else
+        {
+            m_record->m_isMissingWrites = true;
+        }
+    }
+    
+    // Rewriting a word with its own value changes nothing, not even decoded code
+    if( m_memory[ address ] == value )
+    {
+        return false;
+    }
+    
+    if( m_isLoggingWrites )
+    {
+        if( m_writeLog.size() < size_t( cMaxWriteLogLength ) )
+        {
+            WriteLogEntry entry = { address, m_memory[ address ] };
+            m_writeLog.push_back( entry );
+        }
+        else
+        {
+            m_isWriteLogFull = true;
+        }
+    }
+    
+    m_memory[ address ] = value;
+    m_writeEpoch++;
+    m_dirtyPages[ address / ( cDirtyPageWords * 64 ) ] |= uint64_t( 1 ) << ( ( address / cDirtyPageWords ) & 63 );
+    return m_codeCache->Invalidate( address, value );
 }
 
-void BoardSimulation::SetBoard( int x, int y, const BoardSimulation::BoardObject& boardObj )
+inline void BoardSimulation::RecordReads( int32_t address, int32_t wordCount )
 {
-    m_boardObjects[y * m_boardSize + x] = boardObj;
+    if( m_record == NULL || uint32_t( address ) >= uint32_t( cMemorySize ) )
+    {
+        return;
+    }
+    
+    // Only a word's first read matters, and almost every read is of a word read before
+    const int32_t endAddress = std::min( address + wordCount, cMemorySize );
+    while( address < endAddress )
+    {
+        const int32_t wordEnd = std::min( ( address | 63 ) + 1, endAddress );
+        const uint64_t mask = ( ~uint64_t( 0 ) >> ( 64 - ( wordEnd - address ) ) ) << ( address & 63 );
+        uint64_t newBits = mask & ~m_readWords[ address >> 6 ];
+        m_readWords[ address >> 6 ] |= newBits;
+        while( newBits != 0 )
+        {
+            // One run of new words at a time, joined to the last range if it picks up where that ended
+            const int firstBit = __builtin_ctzll( newBits );
+            const uint64_t runBits = ~( newBits >> firstBit );
+            const int bitCount = ( runBits == 0 ) ? 64 : __builtin_ctzll( runBits );
+            newBits = ( firstBit + bitCount >= 64 ) ? 0 : ( newBits & ( ~uint64_t( 0 ) << ( firstBit + bitCount ) ) );
+            
+            const int32_t runAddress = ( address & ~63 ) + firstBit;
+            const int32_t snapshotCount = int32_t( m_record->m_snapshots.size() );
+            GameRecord::ReadRange* lastRead = m_record->m_reads.empty() ? NULL : &m_record->m_reads.back();
+            if( lastRead != NULL && lastRead->m_address + lastRead->m_wordCount == runAddress && lastRead->m_snapshotCount == snapshotCount )
+            {
+                lastRead->m_wordCount += bitCount;
+            }
+            else
+            {
+                GameRecord::ReadRange read = { runAddress, bitCount, snapshotCount };
+                m_record->m_reads.push_back( read );
+            }
+        }
+        address = wordEnd;
+    }
 }
 
 bool BoardSimulation::UpdateSimulation( Error& errorOut )
@@ -355,6 +632,7 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
     }
     
     m_instructionCount++;
+    RecordReads( m_instructionPtr, 3 );
     
     // Grab instruction
     Instruction op = (Instruction)m_memory[ m_instructionPtr ];
@@ -382,8 +660,8 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
             
         case cInstruction_GetPos:
         {
-            m_registerA = m_snake.front().x;
-            m_registerB = m_snake.front().y;
+            m_registerA = GetSnakeHead().x;
+            m_registerB = GetSnakeHead().y;
             break;
         }
             
@@ -427,6 +705,7 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
         {
             if( m_registerA >= 0 && m_registerA < cMemorySize )
             {
+                RecordReads( m_registerA, 1 );
                 m_registerA =  m_memory[ m_registerA ];
             }
             else
@@ -440,6 +719,7 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
         {
             if( m_registerB >= 0 && m_registerB < cMemorySize )
             {
+                RecordReads( m_registerB, 1 );
                 m_registerB =  m_memory[ m_registerB ];
             }
             else
@@ -453,7 +733,7 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
         {
             if( m_registerA >= 0 && m_registerA < cMemorySize )
             {
-                m_memory[ m_registerA ] = m_registerB;
+                WriteMemory( m_registerA, m_registerB );
             }
             else
             {
@@ -464,19 +744,19 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
             
         case cInstruction_Add:
         {
-            m_registerA += m_registerB;
+            m_registerA = AddWords( m_registerA, m_registerB );
             break;
         }
             
         case cInstruction_Sub:
         {
-            m_registerA -= m_registerB;
+            m_registerA = SubtractWords( m_registerA, m_registerB );
             break;
         }
             
         case cInstruction_Mul:
         {
-            m_registerA *= m_registerB;
+            m_registerA = MultiplyWords( m_registerA, m_registerB );
             break;
         }
             
@@ -484,7 +764,7 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
         {
             if( m_registerB != 0 )
             {
-                m_registerA /= m_registerB;
+                m_registerA = DivideWords( m_registerA, m_registerB );
             }
             else
             {
@@ -495,7 +775,14 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
             
         case cInstruction_Mod:
         {
-            m_registerA %= m_registerB;
+            if( m_registerB != 0 )
+            {
+                m_registerA = ModuloWords( m_registerA, m_registerB );
+            }
+            else
+            {
+                errorOut = cError_DivByZero;
+            }
             break;
         }
             
@@ -621,7 +908,7 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
     {
         errorOut = cError_OutOfBounds;
     }
-    else if( m_snake.size() >= m_boardSize * m_boardSize )
+    else if( m_snakeLength >= m_boardSize * m_boardSize )
     {
         errorOut = cError_BoardFilled;
     }
@@ -632,197 +919,1982 @@ bool BoardSimulation::UpdateSimulation( Error& errorOut )
     return moved;
 }
 
-int BoardSimulation::GetFitness() const
-{
-    // What's best: low instructions, low movement, high pellet
-    return ( m_instructionCount / 1000 + m_movementCount ) - m_pelletCount * 100;
-}
-
-void BoardSimulation::AddPellet()
+bool BoardSimulation::RunUntilMoved( Error& errorOut, int& stepCount )
 {
-    // Keep randomizing until we get no collision
-    // Note: board must have empty spaced!
-    bool placed = false;
-    while( !placed )
+    // A board can only be filled on creation (1x1) or by a move; let the reference
+    // path deal with the former so the engines below only check after moves
+    if( m_errorCode != cError_None || m_snakeLength >= m_boardSize * m_boardSize )
     {
-        BoardPosition pos = BoardPosition( rand() % m_boardSize, rand() % m_boardSize );
-        if( GetBoard( pos.x, pos.y ) == cBoardObject_None )
+        while( true )
         {
-            m_pellets.push_back( pos );
-            SetBoard( pos.x, pos.y, cBoardObject_Pellet );
-            placed = true;
+            errorOut = cError_None;
+            bool hasMoved = UpdateSimulation( errorOut );
+            
+            if( stepCount > cStallCount )
+            {
+                errorOut = cError_Stalled;
+            }
+            
+            if( errorOut != cError_None || hasMoved )
+            {
+                stepCount = ( errorOut == cError_None ) ? 0 : stepCount;
+                return hasMoved;
+            }
+            
+            stepCount++;
         }
     }
+    
+    // Decoded blocks do nearly all the work; the last few instructions before
+    // the stall limit are single-stepped so it triggers on the exact instruction
+    bool moved = false;
+    if( RunBlocks( errorOut, stepCount, moved ) )
+    {
+        return moved;
+    }
+    return RunInstructions( errorOut, stepCount );
 }
 
-Error BoardSimulation::MoveSnake( const Move& move )
+bool BoardSimulation::FinishRun( Error errorCode, bool moved, int executedCount, Error& errorOut, int& stepCount )
 {
-    // Compute head position
-    BoardPosition head = m_snake.front();
-    if( move == cMove_Up )
-        head.y--;
-    else if( move == cMove_Down )
-        head.y++;
-    else if( move == cMove_Left )
-        head.x--;
-    else if( move == cMove_Right )
-        head.x++;
-    
-    // Bounds check
-    if( head.x < 0 || head.y < 0 || head.x >= m_boardSize || head.y >= m_boardSize )
+    // Same post-instruction checks as UpdateSimulation()
+    if( m_instructionPtr < 0 || m_instructionPtr >= cMemorySize )
     {
-        return cError_OutOfBoard;
+        errorCode = cError_OutOfBounds;
+    }
+    else if( m_snakeLength >= m_boardSize * m_boardSize )
+    {
+        errorCode = cError_BoardFilled;
     }
     
-    bool consumedPellete = false;
-    BoardObject boardObject = GetBoard( head.x, head.y );
+    m_errorCode = errorCode;
     
-    // Self-hit test
-    if( boardObject == cBoardObject_Snake )
+    // Stall check applies to the last instruction executed, and wins over anything else
+    stepCount += executedCount - 1;
+    errorOut = ( stepCount > cStallCount ) ? cError_Stalled : errorCode;
+    if( errorOut == cError_None )
     {
-        return cError_SelfEat;
+        stepCount = moved ? 0 : ( stepCount + 1 );
     }
-    // If we hit a pellet, mark it
-    else if( boardObject == cBoardObject_Pellet )
-    {
-        m_hungerCount = 0;
-        consumedPellete = true;
-        SetBoard( head.x, head.y, cBoardObject_None );
-        
-        // Remove this pellet from the list
-        for( int i = 0; i < (int)m_pellets.size(); i++ )
+    
+    return moved;
+}
+
+bool BoardSimulation::RunBlocks( Error& errorOut, int& stepCount, bool& movedOut )
+{
+    // Working copies, written back on exit
+    int32_t* const memory = m_memory;
+    CodeCache& codeCache = *m_codeCache;
+    int32_t instructionPtr = m_instructionPtr;
+    int registerA = m_registerA;
+    int registerB = m_registerB;
+    int instructionCount = m_instructionCount;
+    
+    // A block only runs if it ends before the instruction that exceeds the stall limit
+    const int firstInstructionCount = instructionCount;
+    const int stallInstructionCount = instructionCount + std::max( 1, cStallCount + 2 - stepCount );
+    
+    Error errorCode = cError_None;
+    bool moved = false;
+    const DecodedOp* op = NULL;
+    int blockInstructionCount = 0;
+    
+    NativeState nativeState;
+    nativeState.m_boardSize = m_boardSize;
+    nativeState.m_memory = memory;
+    
+    // Brent's cycle detection over block entries. Between moves the machine state is the
+    // instruction pointer, both registers and memory (the board only changes on moves), so
+    // meeting a saved state again with no write in between means the gene loops until it stalls
+    int32_t cycleInstructionPtr = -1;
+    int cycleRegisterA = 0, cycleRegisterB = 0;
+    uint32_t cycleWriteEpoch = 0;
+    int cycleLength = 0, cyclePower = 1;
+    
+    // Leave the block right after the current op, either to finish the run or to look up a new block
+    #define VM_EXIT_AFTER() \
+        instructionPtr = op->m_nextAddress; \
+        instructionCount = blockInstructionCount + op->m_instructionCount; \
+        goto vm_finish;
+    
+    #define VM_RESUME_AFTER() \
+        instructionPtr = op->m_nextAddress; \
+        instructionCount = blockInstructionCount + op->m_instructionCount; \
+        goto vm_block;
+    
+    #define VM_NEXT() op++; VM_DISPATCH()
+    
+    #if defined( __GNUC__ ) && !defined( __NoComputedGoto__ )
+    
+        static void* const dispatchTable[ cDecodedKindCount ] =
         {
-            if( m_pellets[ i ].x == head.x &&
-                m_pellets[ i ].y == head.y )
-            {
-                m_pelletCount++;
-                m_pellets.erase( m_pellets.begin() + i );
-                break;
-            }
-        }
+            &&vm_Nop, &&vm_ZeroA, &&vm_ZeroB, &&vm_GetPos, &&vm_Board, &&vm_BSize, &&vm_SetA, &&vm_SetB, &&vm_Swap,
+            &&vm_ReadA, &&vm_ReadB, &&vm_Write,
+            &&vm_Add, &&vm_Sub, &&vm_Mul, &&vm_Div, &&vm_Mod,
+            &&vm_Equal, &&vm_NE, &&vm_LT, &&vm_GT, &&vm_LTE, &&vm_GTE,
+            &&vm_And, &&vm_Or, &&vm_Not,
+            &&vm_IfJmp, &&vm_Jmp,
+            &&vm_GoUp, &&vm_GoDown, &&vm_GoLeft, &&vm_GoRight,
+            &&vm_SetAReadA, &&vm_SetBReadB, &&vm_SetBSwapWrite, &&vm_GetPosSwap,
+            &&vm_SetBEqual, &&vm_SetBNE, &&vm_SetBLT, &&vm_SetBGT, &&vm_SetBLTE, &&vm_SetBGTE,
+            &&vm_GetPosSetBEqual, &&vm_GetPosSetBNE, &&vm_GetPosSetBLT, &&vm_GetPosSetBGT, &&vm_GetPosSetBLTE, &&vm_GetPosSetBGTE,
+            &&vm_Next, &&vm_NopRun,
+        };
         
-        // Add a new pellet
-        AddPellet();
-    }
+        #define VM_DISPATCH() goto *dispatchTable[ op->m_kind ];
+        #define VM_CASE( name ) vm_##name:
+        #define VM_DECODED_CASE( name ) vm_##name:
+        #define VM_SWITCH_BEGIN() VM_DISPATCH();
+        #define VM_SWITCH_END()
     
-    // Moving ahead
-    m_snake.insert( m_snake.begin(), head );
-    SetBoard( head.x, head.y, cBoardObject_Snake );
+    #else
     
-    // Remove tail if we haven't consumed a pellet
-    if( consumedPellete == false )
+        #define VM_DISPATCH() continue;
+        #define VM_CASE( name ) case cInstruction_##name:
+        #define VM_DECODED_CASE( name ) case cDecoded_##name:
+        #define VM_SWITCH_BEGIN() while( true ) { switch( op->m_kind ) {
+        #define VM_SWITCH_END() } }
+    
+    #endif
+    
+vm_block:
+    
+    // Only jumps can leave memory; the end-of-run checks report it
+    if( uint32_t( instructionPtr ) >= uint32_t( cMemorySize ) )
     {
-        const BoardPosition& oldTail = m_snake.back();
-        SetBoard( oldTail.x, oldTail.y, cBoardObject_None );
-        m_snake.pop_back();
+        goto vm_finish;
     }
     
-    // Special rule: has the snake starved?
-    m_hungerCount++;
-    if( m_hungerCount >= cMaxHunger )
+    // Skip straight to the instruction that stalls; the counts come out the same
+    if( instructionPtr == cycleInstructionPtr && registerA == cycleRegisterA && registerB == cycleRegisterB && m_writeEpoch == cycleWriteEpoch )
     {
-        return cError_Starved;
+        instructionCount = stallInstructionCount;
+        goto vm_finish;
     }
     
-    // All done!
-    m_movementCount++;
-    return cError_None;
-}
-
-/*** Simulation Controller ***/
-
-SimSnake::SimSnake( int boardSize, int genePoolCount )
-    : m_activeBoard( NULL )
-    , m_boardSize( boardSize )
-    , m_activeGeneIndex( 0 )
-    , m_stepCount( 0 )
-    , m_generationCount( 0 )
-    , m_genePoolSize( genePoolCount )
-    , m_maxMovementCount( 0 )
-    , m_maxPelletEattenCount( 0 )
-{
-    // Initialize all gene ranks to -1 (not yet measured)
-    for( int i = 0; i < m_genePoolSize; i++ )
+    if( ++cycleLength == cyclePower )
     {
-        m_geneFitness.push_back( GeneFitnessPair( i, INT_MAX ) );
+        cycleInstructionPtr = instructionPtr;
+        cycleRegisterA = registerA;
+        cycleRegisterB = registerB;
+        cycleWriteEpoch = m_writeEpoch;
+        cycleLength = 0;
+        cyclePower *= 2;
     }
     
-    // Load for first board game
-    Gene firstGene;
-    LoadGene( "Gene0", firstGene);
-    
-    m_activeBoard = new BoardSimulation( boardSize, firstGene );
-}
-
-SimSnake::~SimSnake()
-{
-    delete m_activeBoard;
-}
-
-void SimSnake::Update()
-{
-    // Keep repeating until we hit an error or we've moved
-    while( true )
     {
-        // Update board
-        Error errorOut = cError_None;
-        bool hasMoved = m_activeBoard->UpdateSimulation( errorOut );
-        
-        // Stall check
-        if( m_stepCount > cStallCount )
+        const DecodedBlock& block = codeCache.GetBlock( memory, instructionPtr );
+        RecordReads( block.m_address, block.m_endAddress - block.m_address );
+        if( instructionCount + block.m_instructionCount >= stallInstructionCount )
         {
-            errorOut = cError_Stalled;
+            // A run of Nop can still be skipped up to the instruction that stalls
+            if( codeCache.GetOps( block )->m_kind == cDecoded_NopRun )
+            {
+                const int skipCount = stallInstructionCount - 1 - instructionCount;
+                instructionPtr += skipCount;
+                instructionCount += skipCount;
+            }
+            
+            // Hand the rest over to RunInstructions()
+            m_instructionPtr = instructionPtr;
+            m_registerA = registerA;
+            m_registerB = registerB;
+            m_instructionCount = instructionCount;
+            stepCount += instructionCount - firstInstructionCount;
+            return false;
         }
         
+        blockInstructionCount = instructionCount;
+        instructionCount += block.m_instructionCount;
+        op = codeCache.GetOps( block );
+        
+        // Translated code reads memory out of sight, so recorded games interpret blocks that read it
+        const NativeBlock nativeBlock = ( m_record == NULL || !block.m_isReadingMemory ) ? codeCache.GetNativeBlock( block ) : NULL;
+        if( nativeBlock != NULL )
+        {
+            nativeState.m_registerA = registerA;
+            nativeState.m_registerB = registerB;
+            nativeState.m_headX = GetSnakeHead().x;
+            nativeState.m_headY = GetSnakeHead().y;
+            nativeState.m_budget = stallInstructionCount - 1 - instructionCount;
+            
+            const int32_t resumeIndex = nativeBlock( &nativeState );
+            registerA = nativeState.m_registerA;
+            registerB = nativeState.m_registerB;
+            
+            // Either done with the block (maybe after looping on it), or the rest is interpreted
+            if( resumeIndex == 0 )
+            {
+                instructionPtr = nativeState.m_instructionPtr;
+                instructionCount = stallInstructionCount - 1 - nativeState.m_budget;
+                goto vm_block;
+            }
+            op += resumeIndex;
+        }
+    }
+    
+    VM_SWITCH_BEGIN()
+    
+    VM_CASE( Nop )
+        VM_NEXT();
+    
+    VM_CASE( ZeroA )
+        registerA = 0;
+        VM_NEXT();
+    
+    VM_CASE( ZeroB )
+        registerB = 0;
+        VM_NEXT();
+    
+    VM_CASE( GetPos )
+        registerA = GetSnakeHead().x;
+        registerB = GetSnakeHead().y;
+        VM_NEXT();
+    
+    VM_CASE( Board )
+        registerA = GetBoard( op->m_arg0, op->m_arg1 );
+        VM_NEXT();
+    
+    VM_CASE( BSize )
+        registerA = m_boardSize;
+        VM_NEXT();
+    
+    VM_CASE( SetA )
+        registerA = op->m_arg0;
+        VM_NEXT();
+    
+    VM_CASE( SetB )
+        registerB = op->m_arg0;
+        VM_NEXT();
+    
+    VM_CASE( Swap )
+        std::swap( registerA, registerB );
+        VM_NEXT();
+    
+    // Out-of-bounds memory access is silently ignored, see RunInstructions()
+    VM_CASE( ReadA )
+        if( registerA >= 0 && registerA < cMemorySize )
+        {
+            RecordReads( registerA, 1 );
+            registerA = memory[ registerA ];
+        }
+        VM_NEXT();
+    
+    VM_CASE( ReadB )
+        if( registerB >= 0 && registerB < cMemorySize )
+        {
+            RecordReads( registerB, 1 );
+            registerB = memory[ registerB ];
+        }
+        VM_NEXT();
+    
+    // Rewriting code drops its blocks, including possibly this one
+    VM_CASE( Write )
+        if( registerA >= 0 && registerA < cMemorySize && WriteMemory( registerA, registerB ) )
+        {
+            VM_RESUME_AFTER();
+        }
+        VM_NEXT();
+    
+    VM_CASE( Add )
+        registerA = AddWords( registerA, registerB );
+        VM_NEXT();
+    
+    VM_CASE( Sub )
+        registerA = SubtractWords( registerA, registerB );
+        VM_NEXT();
+    
+    VM_CASE( Mul )
+        registerA = MultiplyWords( registerA, registerB );
+        VM_NEXT();
+    
+    VM_CASE( Div )
+        if( registerB == 0 )
+        {
+            errorCode = cError_DivByZero;
+            VM_EXIT_AFTER();
+        }
+        registerA = DivideWords( registerA, registerB );
+        VM_NEXT();
+    
+    VM_CASE( Mod )
+        if( registerB == 0 )
+        {
+            errorCode = cError_DivByZero;
+            VM_EXIT_AFTER();
+        }
+        registerA = ModuloWords( registerA, registerB );
+        VM_NEXT();
+    
+    VM_CASE( Equal )
+        registerA = ( registerA == registerB );
+        VM_NEXT();
+    
+    VM_CASE( NE )
+        registerA = ( registerA != registerB );
+        VM_NEXT();
+    
+    VM_CASE( LT )
+        registerA = ( registerA < registerB );
+        VM_NEXT();
+    
+    VM_CASE( GT )
+        registerA = ( registerA > registerB );
+        VM_NEXT();
+    
+    VM_CASE( LTE )
+        registerA = ( registerA <= registerB );
+        VM_NEXT();
+    
+    VM_CASE( GTE )
+        registerA = ( registerA >= registerB );
+        VM_NEXT();
+    
+    VM_CASE( And )
+        registerA = ( (registerA != 0) && (registerB != 0) );
+        VM_NEXT();
+    
+    VM_CASE( Or )
+        registerA = ( (registerA != 0) || (registerB != 0) );
+        VM_NEXT();
+    
+    VM_CASE( Not )
+        registerA = ( registerA == 0 );
+        VM_NEXT();
+    
+    // Jumps are relative to the jump instruction itself, which is two words long
+    VM_CASE( IfJmp )
+        instructionPtr = ( registerA != 0 ) ? ( op->m_nextAddress - 2 + op->m_arg0 ) : op->m_nextAddress;
+        goto vm_block;
+    
+    VM_CASE( Jmp )
+        instructionPtr = op->m_nextAddress - 2 + op->m_arg0;
+        goto vm_block;
+    
+    VM_CASE( GoUp )
+        errorCode = MoveSnake( cMove_Up );
+        moved = true;
+        VM_EXIT_AFTER();
+    
+    VM_CASE( GoDown )
+        errorCode = MoveSnake( cMove_Down );
+        moved = true;
+        VM_EXIT_AFTER();
+    
+    VM_CASE( GoLeft )
+        errorCode = MoveSnake( cMove_Left );
+        moved = true;
+        VM_EXIT_AFTER();
+    
+    VM_CASE( GoRight )
+        errorCode = MoveSnake( cMove_Right );
+        moved = true;
+        VM_EXIT_AFTER();
+    
+    VM_DECODED_CASE( SetAReadA )
+        RecordReads( op->m_arg0, 1 );
+        registerA = ( op->m_arg0 >= 0 && op->m_arg0 < cMemorySize ) ? memory[ op->m_arg0 ] : op->m_arg0;
+        VM_NEXT();
+    
+    VM_DECODED_CASE( SetBReadB )
+        RecordReads( op->m_arg0, 1 );
+        registerB = ( op->m_arg0 >= 0 && op->m_arg0 < cMemorySize ) ? memory[ op->m_arg0 ] : op->m_arg0;
+        VM_NEXT();
+    
+    VM_DECODED_CASE( SetBSwapWrite )
+        registerB = registerA;
+        registerA = op->m_arg0;
+        if( registerA >= 0 && registerA < cMemorySize && WriteMemory( registerA, registerB ) )
+        {
+            VM_RESUME_AFTER();
+        }
+        VM_NEXT();
+    
+    VM_DECODED_CASE( GetPosSwap )
+        registerA = GetSnakeHead().y;
+        registerB = GetSnakeHead().x;
+        VM_NEXT();
+    
+    VM_DECODED_CASE( SetBEqual )
+        registerB = op->m_arg0;
+        registerA = ( registerA == registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( SetBNE )
+        registerB = op->m_arg0;
+        registerA = ( registerA != registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( SetBLT )
+        registerB = op->m_arg0;
+        registerA = ( registerA < registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( SetBGT )
+        registerB = op->m_arg0;
+        registerA = ( registerA > registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( SetBLTE )
+        registerB = op->m_arg0;
+        registerA = ( registerA <= registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( SetBGTE )
+        registerB = op->m_arg0;
+        registerA = ( registerA >= registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( GetPosSetBEqual )
+        registerB = op->m_arg0;
+        registerA = ( GetSnakeHead().x == registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( GetPosSetBNE )
+        registerB = op->m_arg0;
+        registerA = ( GetSnakeHead().x != registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( GetPosSetBLT )
+        registerB = op->m_arg0;
+        registerA = ( GetSnakeHead().x < registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( GetPosSetBGT )
+        registerB = op->m_arg0;
+        registerA = ( GetSnakeHead().x > registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( GetPosSetBLTE )
+        registerB = op->m_arg0;
+        registerA = ( GetSnakeHead().x <= registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( GetPosSetBGTE )
+        registerB = op->m_arg0;
+        registerA = ( GetSnakeHead().x >= registerB );
+        VM_NEXT();
+    
+    VM_DECODED_CASE( Next )
+        instructionPtr = op->m_nextAddress;
+        goto vm_block;
+    
+    // The block already counted every skipped Nop
+    VM_DECODED_CASE( NopRun )
+        instructionPtr = op->m_nextAddress;
+        goto vm_block;
+    
+    VM_SWITCH_END()
+    
+    #undef VM_EXIT_AFTER
+    #undef VM_RESUME_AFTER
+    #undef VM_NEXT
+    #undef VM_DISPATCH
+    #undef VM_CASE
+    #undef VM_DECODED_CASE
+    #undef VM_SWITCH_BEGIN
+    #undef VM_SWITCH_END
+    
+vm_finish:
+    
+    m_instructionPtr = instructionPtr;
+    m_registerA = registerA;
+    m_registerB = registerB;
+    m_instructionCount = instructionCount;
+    
+    movedOut = FinishRun( errorCode, moved, instructionCount - firstInstructionCount, errorOut, stepCount );
+    return true;
+}
+
+bool BoardSimulation::RunInstructions( Error& errorOut, int& stepCount )
+{
+    // Working copies, written back on exit
+    int32_t* const memory = m_memory;
+    int32_t instructionPtr = m_instructionPtr;
+    int registerA = m_registerA;
+    int registerB = m_registerB;
+    int instructionCount = m_instructionCount;
+    
+    // Instruction number that exceeds the stall limit; it is still executed,
+    // then reported as stalled, exactly like SimSnake's per-step check
+    const int firstInstructionCount = instructionCount;
+    const int stallInstructionCount = instructionCount + std::max( 1, cStallCount + 2 - stepCount );
+    
+    Error errorCode = cError_None;
+    bool moved = false;
+    int32_t arg0 = 0, arg1 = 0;
+    
+    // Fetch next word; anything outside the instruction set executes as Nop
+    #define VM_FETCH() \
+        instructionCount++; \
+        RecordReads( instructionPtr, 3 ); \
+        arg0 = memory[ instructionPtr + 1 ]; \
+        arg1 = memory[ instructionPtr + 2 ]; \
+        (void)arg1;
+    
+    #define VM_OPCODE() \
+        ( ( uint32_t( memory[ instructionPtr ] ) < uint32_t( cInstructionCount ) ) ? memory[ instructionPtr ] : int32_t( cInstruction_Nop ) )
+    
+    // After a plain instruction: only the instruction pointer and stall limit can end the run
+    #define VM_CONTINUE() \
+        if( uint32_t( instructionPtr ) >= uint32_t( cMemorySize ) || instructionCount == stallInstructionCount ) \
+        { \
+            goto vm_finish; \
+        } \
+        VM_DISPATCH()
+    
+    #if defined( __GNUC__ ) && !defined( __NoComputedGoto__ )
+    
+        // Direct-threaded: every handler jumps straight to the next one
+        static void* const dispatchTable[ cInstructionCount ] =
+        {
+            &&vm_Nop, &&vm_ZeroA, &&vm_ZeroB, &&vm_GetPos, &&vm_Board, &&vm_BSize, &&vm_SetA, &&vm_SetB, &&vm_Swap,
+            &&vm_ReadA, &&vm_ReadB, &&vm_Write,
+            &&vm_Add, &&vm_Sub, &&vm_Mul, &&vm_Div, &&vm_Mod,
+            &&vm_Equal, &&vm_NE, &&vm_LT, &&vm_GT, &&vm_LTE, &&vm_GTE,
+            &&vm_And, &&vm_Or, &&vm_Not,
+            &&vm_IfJmp, &&vm_Jmp,
+            &&vm_GoUp, &&vm_GoDown, &&vm_GoLeft, &&vm_GoRight,
+        };
+        
+        #define VM_DISPATCH() { VM_FETCH(); goto *dispatchTable[ VM_OPCODE() ]; }
+        #define VM_CASE( name ) vm_##name:
+        #define VM_SWITCH_BEGIN() VM_DISPATCH();
+        #define VM_SWITCH_END()
+    
+    #else
+    
+        // Portable fallback: same handlers, one switch per instruction
+        #define VM_DISPATCH() continue;
+        #define VM_CASE( name ) case cInstruction_##name:
+        #define VM_SWITCH_BEGIN() while( true ) { VM_FETCH(); switch( VM_OPCODE() ) {
+        #define VM_SWITCH_END() } }
+    
+    #endif
+    
+    VM_SWITCH_BEGIN()
+    
+    VM_CASE( Nop )
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( ZeroA )
+        registerA = 0;
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( ZeroB )
+        registerB = 0;
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( GetPos )
+        registerA = GetSnakeHead().x;
+        registerB = GetSnakeHead().y;
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( Board )
+        registerA = GetBoard( arg0, arg1 );
+        instructionPtr += 3;
+        VM_CONTINUE();
+    
+    VM_CASE( BSize )
+        registerA = m_boardSize;
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( SetA )
+        registerA = arg0;
+        instructionPtr += 2;
+        VM_CONTINUE();
+    
+    VM_CASE( SetB )
+        registerB = arg0;
+        instructionPtr += 2;
+        VM_CONTINUE();
+    
+    VM_CASE( Swap )
+        std::swap( registerA, registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    // Out-of-bounds memory access is silently ignored: UpdateSimulation() flags it,
+    // but then overwrites the flag with the instruction's (empty) error result
+    VM_CASE( ReadA )
+        if( registerA >= 0 && registerA < cMemorySize )
+        {
+            RecordReads( registerA, 1 );
+            registerA = memory[ registerA ];
+        }
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( ReadB )
+        if( registerB >= 0 && registerB < cMemorySize )
+        {
+            RecordReads( registerB, 1 );
+            registerB = memory[ registerB ];
+        }
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( Write )
+        if( registerA >= 0 && registerA < cMemorySize )
+        {
+            WriteMemory( registerA, registerB );
+        }
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( Add )
+        registerA = AddWords( registerA, registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( Sub )
+        registerA = SubtractWords( registerA, registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( Mul )
+        registerA = MultiplyWords( registerA, registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( Div )
+        instructionPtr++;
+        if( registerB == 0 )
+        {
+            errorCode = cError_DivByZero;
+            goto vm_finish;
+        }
+        registerA = DivideWords( registerA, registerB );
+        VM_CONTINUE();
+    
+    VM_CASE( Mod )
+        instructionPtr++;
+        if( registerB == 0 )
+        {
+            errorCode = cError_DivByZero;
+            goto vm_finish;
+        }
+        registerA = ModuloWords( registerA, registerB );
+        VM_CONTINUE();
+    
+    VM_CASE( Equal )
+        registerA = ( registerA == registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( NE )
+        registerA = ( registerA != registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( LT )
+        registerA = ( registerA < registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( GT )
+        registerA = ( registerA > registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( LTE )
+        registerA = ( registerA <= registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( GTE )
+        registerA = ( registerA >= registerB );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( And )
+        registerA = ( (registerA != 0) && (registerB != 0) );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( Or )
+        registerA = ( (registerA != 0) || (registerB != 0) );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( Not )
+        registerA = ( registerA == 0 );
+        instructionPtr++;
+        VM_CONTINUE();
+    
+    VM_CASE( IfJmp )
+        instructionPtr += ( registerA != 0 ) ? arg0 : 2;
+        VM_CONTINUE();
+    
+    VM_CASE( Jmp )
+        instructionPtr += arg0;
+        VM_CONTINUE();
+    
+    VM_CASE( GoUp )
+        errorCode = MoveSnake( cMove_Up );
+        moved = true;
+        instructionPtr++;
+        goto vm_finish;
+    
+    VM_CASE( GoDown )
+        errorCode = MoveSnake( cMove_Down );
+        moved = true;
+        instructionPtr++;
+        goto vm_finish;
+    
+    VM_CASE( GoLeft )
+        errorCode = MoveSnake( cMove_Left );
+        moved = true;
+        instructionPtr++;
+        goto vm_finish;
+    
+    VM_CASE( GoRight )
+        errorCode = MoveSnake( cMove_Right );
+        moved = true;
+        instructionPtr++;
+        goto vm_finish;
+    
+    VM_SWITCH_END()
+    
+    #undef VM_FETCH
+    #undef VM_OPCODE
+    #undef VM_CONTINUE
+    #undef VM_DISPATCH
+    #undef VM_CASE
+    #undef VM_SWITCH_BEGIN
+    #undef VM_SWITCH_END
+    
+vm_finish:
+    
+    m_instructionPtr = instructionPtr;
+    m_registerA = registerA;
+    m_registerB = registerB;
+    m_instructionCount = instructionCount;
+    
+    return FinishRun( errorCode, moved, instructionCount - firstInstructionCount, errorOut, stepCount );
+}
+
+Error BoardSimulation::RunUntilDeath()
+{
+    static_assert( cMoveLookupSize >= 2 * cMaxHunger, "Move lookup must stay at most half full" );
+    
+    // Same stall semantics as SimSnake::Update(): count instructions since the last move
+    int stepCount = 0;
+    bool isDetectingCycles = true;
+    
+    ResetMoveHistory();
+    while( true )
+    {
+        Error errorOut = cError_None;
+        const bool moved = RunUntilMoved( errorOut, stepCount );
+        
+        if( errorOut != cError_None )
+        {
+            m_isLoggingWrites = false;
+            return errorOut;
+        }
+        
+        if( !moved || !isDetectingCycles )
+        {
+            continue;
+        }
+        
+        if( m_record != NULL )
+        {
+            TakeSnapshot();
+        }
+        
+        const int moveCount = FindRepeatedMove();
+        if( moveCount > 0 )
+        {
+            // Nothing gets eaten on the way, so the same moves repeat until the snake starves;
+            // skip all repetitions that end before the starving move
+            const int instructionCount = m_instructionCount - m_moveRecords[ m_moveRecords.size() - moveCount ].m_instructionCount;
+            const int skipCount = ( cMaxHunger - m_hungerCount - 1 ) / moveCount;
+            
+            m_movementCount += skipCount * moveCount;
+            m_hungerCount += skipCount * moveCount;
+            m_instructionCount += skipCount * instructionCount;
+            
+            // Less than one repetition is left, so no state can come back in time
+            isDetectingCycles = false;
+            m_isLoggingWrites = false;
+        }
+    }
+}
+
+Error BoardSimulation::RecordUntilDeath( GameRecord& record )
+{
+    record.m_reads.clear();
+    record.m_snapshots.clear();
+    record.m_writes.clear();
+    return RunRecorded( record );
+}
+
+Error BoardSimulation::ResumeUntilDeath( const GameRecord& fromRecord, int snapshotIndex, GameRecord& record )
+{
+    // Up to the snapshot, the game went the same way; reads come in order of snapshot count
+    const GameRecord::Snapshot& snapshot = fromRecord.m_snapshots.at( snapshotIndex );
+    size_t readCount = 0;
+    while( readCount < fromRecord.m_reads.size() && fromRecord.m_reads[ readCount ].m_snapshotCount <= snapshotIndex )
+    {
+        readCount++;
+    }
+    record.m_reads.assign( fromRecord.m_reads.begin(), fromRecord.m_reads.begin() + readCount );
+    record.m_snapshots.assign( fromRecord.m_snapshots.begin(), fromRecord.m_snapshots.begin() + snapshotIndex + 1 );
+    record.m_writes.assign( fromRecord.m_writes.begin(), fromRecord.m_writes.begin() + snapshot.m_writeCount );
+    
+    // Memory is this gene with every write made so far
+    for( size_t i = 0; i < record.m_writes.size(); i++ )
+    {
+        WriteMemory( record.m_writes[ i ].m_address, record.m_writes[ i ].m_value );
+    }
+    
+    m_instructionPtr = snapshot.m_instructionPtr;
+    m_registerA = snapshot.m_registerA;
+    m_registerB = snapshot.m_registerB;
+    m_instructionCount = snapshot.m_instructionCount;
+    m_movementCount = snapshot.m_movementCount;
+    m_pelletCount = snapshot.m_pelletCount;
+    m_hungerCount = snapshot.m_hungerCount;
+    m_random = snapshot.m_random;
+    
+    // Rebuild the board from its lists; the snake's place in its ring buffer does not matter
+    const int boardWordCount = ( m_boardSize * m_boardSize + 63 ) / 64;
+    memset( (void*)m_snakeCells, 0, sizeof( uint64_t ) * boardWordCount );
+    memset( (void*)m_pelletCells, 0, sizeof( uint64_t ) * boardWordCount );
+    std::fill( m_pelletIndices, m_pelletIndices + m_boardSize * m_boardSize, -1 );
+    std::fill( m_freeCellIndices, m_freeCellIndices + m_boardSize * m_boardSize, -1 );
+    
+    m_snakeHead = 0;
+    m_snakeLength = int( snapshot.m_snake.size() );
+    for( int i = 0; i < m_snakeLength; i++ )
+    {
+        const int cell = snapshot.m_snake[ i ].y * m_boardSize + snapshot.m_snake[ i ].x;
+        m_snakeBody[ i ] = snapshot.m_snake[ i ];
+        m_snakeCells[ cell >> 6 ] |= uint64_t( 1 ) << ( cell & 63 );
+    }
+    
+    m_pellets = snapshot.m_pellets;
+    for( size_t i = 0; i < m_pellets.size(); i++ )
+    {
+        const int cell = m_pellets[ i ].y * m_boardSize + m_pellets[ i ].x;
+        m_pelletIndices[ cell ] = int32_t( i );
+        m_pelletCells[ cell >> 6 ] |= uint64_t( 1 ) << ( cell & 63 );
+    }
+    
+    m_freeCellCount = int( snapshot.m_freeCells.size() );
+    for( int i = 0; i < m_freeCellCount; i++ )
+    {
+        m_freeCells[ i ] = snapshot.m_freeCells[ i ];
+        m_freeCellIndices[ m_freeCells[ i ] ] = i;
+    }
+    
+    return RunRecorded( record );
+}
+
+Error BoardSimulation::RunRecorded( GameRecord& record )
+{
+    if( m_readWords == NULL )
+    {
+        m_readWords = new uint64_t[ cMemorySize / 64 ];
+        memset( (void*)m_readWords, 0, sizeof( uint64_t ) * ( cMemorySize / 64 ) );
+    }
+    for( size_t i = 0; i < record.m_reads.size(); i++ )
+    {
+        for( int32_t address = record.m_reads[ i ].m_address; address < record.m_reads[ i ].m_address + record.m_reads[ i ].m_wordCount; address++ )
+        {
+            m_readWords[ address >> 6 ] |= uint64_t( 1 ) << ( address & 63 );
+        }
+    }
+    record.m_isMissingWrites = false;
+    
+    m_record = &record;
+    const Error error = RunUntilDeath();
+    m_record = NULL;
+    
+    record.m_error = error;
+    record.m_fitness = GetFitness();
+    record.m_instructionCount = m_instructionCount;
+    record.m_movementCount = m_movementCount;
+    record.m_pelletCount = m_pelletCount;
+    
+    // Cleared range by range, since little was read
+    for( size_t i = 0; i < record.m_reads.size(); i++ )
+    {
+        const GameRecord::ReadRange& read = record.m_reads[ i ];
+        std::fill( m_readWords + ( read.m_address >> 6 ), m_readWords + ( ( read.m_address + read.m_wordCount - 1 ) >> 6 ) + 1, 0 );
+    }
+    return error;
+}
+
+void BoardSimulation::TakeSnapshot()
+{
+    // The first after cFirstSnapshotInstructionCount instructions, then at twice the count of the last
+    const int64_t nextInstructionCount = m_record->m_snapshots.empty() ? cFirstSnapshotInstructionCount : 2 * int64_t( m_record->m_snapshots.back().m_instructionCount );
+    if( m_record->m_isMissingWrites || m_instructionCount < nextInstructionCount )
+    {
+        return;
+    }
+    
+    m_record->m_snapshots.push_back( GameRecord::Snapshot() );
+    GameRecord::Snapshot& snapshot = m_record->m_snapshots.back();
+    snapshot.m_instructionPtr = m_instructionPtr;
+    snapshot.m_registerA = m_registerA;
+    snapshot.m_registerB = m_registerB;
+    snapshot.m_instructionCount = m_instructionCount;
+    snapshot.m_movementCount = m_movementCount;
+    snapshot.m_pelletCount = m_pelletCount;
+    snapshot.m_hungerCount = m_hungerCount;
+    snapshot.m_writeCount = int( m_record->m_writes.size() );
+    snapshot.m_random = m_random;
+    
+    const SnakeView snake = GetSnake();
+    for( int i = 0; i < snake.size(); i++ )
+    {
+        snapshot.m_snake.push_back( snake[ i ] );
+    }
+    snapshot.m_pellets = m_pellets;
+    snapshot.m_freeCells.assign( m_freeCells, m_freeCells + m_freeCellCount );
+}
+
+int GameRecord::FindFirstChange( const GenePool& genePool, int geneIndex, int otherGeneIndex ) const
+{
+    // Segments and chunks with equal hashes hold the same words; a child shares all but a few
+    uint64_t changedChunks[ GenePool::cChunkCount / 64 ] = {};
+    for( int segment = 0; segment < GenePool::cSegmentCount; segment++ )
+    {
+        if( genePool.GetSegmentHash( geneIndex, segment ) == genePool.GetSegmentHash( otherGeneIndex, segment ) )
+        {
+            continue;
+        }
+        
+        for( int chunk = segment * GenePool::cSegmentChunks; chunk < ( segment + 1 ) * GenePool::cSegmentChunks; chunk++ )
+        {
+            if( genePool.GetChunkHash( geneIndex, chunk ) != genePool.GetChunkHash( otherGeneIndex, chunk ) )
+            {
+                changedChunks[ chunk >> 6 ] |= uint64_t( 1 ) << ( chunk & 63 );
+            }
+        }
+    }
+    
+    // Reads are in order, so the first read of a changed word had the fewest snapshots
+    for( size_t i = 0; i < m_reads.size(); i++ )
+    {
+        const int32_t endAddress = m_reads[ i ].m_address + m_reads[ i ].m_wordCount;
+        for( int32_t address = m_reads[ i ].m_address; address < endAddress; )
+        {
+            const int chunk = address / GenePool::cChunkWords;
+            const int32_t chunkEnd = std::min( ( chunk + 1 ) * GenePool::cChunkWords, endAddress );
+            if( ( changedChunks[ chunk >> 6 ] & ( uint64_t( 1 ) << ( chunk & 63 ) ) ) != 0 )
+            {
+                const int32_t* words = genePool.GetChunk( geneIndex, chunk );
+                const int32_t* otherWords = genePool.GetChunk( otherGeneIndex, chunk );
+                for( int32_t word = address % GenePool::cChunkWords; word < chunkEnd - chunk * GenePool::cChunkWords; word++ )
+                {
+                    if( words[ word ] != otherWords[ word ] )
+                    {
+                        return m_reads[ i ].m_snapshotCount;
+                    }
+                }
+            }
+            address = chunkEnd;
+        }
+    }
+    return -1;
+}
+
+void BoardSimulation::ResetMoveHistory()
+{
+    m_moveRecords.clear();
+    m_historyPelletCount = m_pelletCount;
+    memset( (void*)m_moveLookup, 0, sizeof( m_moveLookup ) );
+    
+    // Tail first, so the last m_snakeLength heads are always the snake
+    const SnakeView snake = GetSnake();
+    m_headHistory.clear();
+    for( int i = snake.size() - 1; i >= 0; i-- )
+    {
+        m_headHistory.push_back( snake[ i ] );
+    }
+    
+    m_isLoggingWrites = true;
+    m_isWriteLogFull = false;
+    m_writeLog.clear();
+}
+
+int BoardSimulation::FindRepeatedMove()
+{
+    // Pellets only change by eating, and snakes only grow by eating; anything eaten
+    // (or too many writes to compare memory) starts a new history
+    if( m_pelletCount != m_historyPelletCount || m_isWriteLogFull )
+    {
+        ResetMoveHistory();
+    }
+    else
+    {
+        m_headHistory.push_back( GetSnakeHead() );
+    }
+    
+    const int historyLength = int( m_headHistory.size() );
+    const BoardPosition& head = GetSnakeHead();
+    const uint64_t key = RandomStream::Mix( ( uint64_t( uint32_t( m_instructionPtr ) ) << 32 ) ^ ( uint64_t( uint32_t( m_registerA ) ) << 16 ) ^ uint32_t( m_registerB ) ^ ( uint64_t( head.x ) << 48 ) ^ ( uint64_t( head.y ) << 56 ) );
+    
+    int slot = int( key & ( cMoveLookupSize - 1 ) );
+    for( ; m_moveLookup[ slot ] != 0; slot = ( slot + 1 ) & ( cMoveLookupSize - 1 ) )
+    {
+        const int recordIndex = m_moveLookup[ slot ] - 1;
+        const MoveRecord& record = m_moveRecords[ recordIndex ];
+        const int moveCount = int( m_moveRecords.size() ) - recordIndex;
+        if( record.m_instructionPtr != m_instructionPtr || record.m_registerA != m_registerA || record.m_registerB != m_registerB )
+        {
+            continue;
+        }
+        
+        // Same snake: the last m_snakeLength heads then and now
+        bool isRepeated = true;
+        for( int i = 0; i < m_snakeLength && isRepeated; i++ )
+        {
+            const BoardPosition& thenCell = m_headHistory[ historyLength - 1 - moveCount - i ];
+            const BoardPosition& nowCell = m_headHistory[ historyLength - 1 - i ];
+            isRepeated = ( thenCell.x == nowCell.x && thenCell.y == nowCell.y );
+        }
+        
+        // Same memory: every word written since holds its value from before the first of those writes
+        if( isRepeated )
+        {
+            std::vector< WriteLogEntry > writes( m_writeLog.begin() + record.m_writeLogLength, m_writeLog.end() );
+            std::stable_sort( writes.begin(), writes.end(), []( const WriteLogEntry& a, const WriteLogEntry& b ) { return a.m_address < b.m_address; } );
+            for( size_t i = 0; i < writes.size() && isRepeated; i++ )
+            {
+                const bool isFirstWrite = ( i == 0 ) || writes[ i ].m_address != writes[ i - 1 ].m_address;
+                isRepeated = !isFirstWrite || m_memory[ writes[ i ].m_address ] == writes[ i ].m_value;
+            }
+        }
+        
+        if( isRepeated )
+        {
+            return moveCount;
+        }
+    }
+    
+    MoveRecord record = { m_instructionPtr, m_registerA, m_registerB, m_instructionCount, int( m_writeLog.size() ) };
+    m_moveLookup[ slot ] = int32_t( m_moveRecords.size() ) + 1;
+    m_moveRecords.push_back( record );
+    return 0;
+}
+
+int BoardSimulation::GetFitness() const
+{
+    // What's best: low instructions, low movement, high pellet
+    return ( m_instructionCount / 1000 + m_movementCount ) - m_pelletCount * 100;
+}
+
+void BoardSimulation::AddPellet()
+{
+    // Pick uniformly among the free cells, same odds as picking random cells until one is free
+    if( m_freeCellCount == 0 )
+    {
+        return;
+    }
+    
+    const int cell = m_freeCells[ m_random.NextInt( m_freeCellCount ) ];
+    BoardPosition pos( cell % m_boardSize, cell / m_boardSize );
+    m_pelletIndices[ cell ] = int32_t( m_pellets.size() );
+    m_pellets.push_back( pos );
+    SetBoard( pos.x, pos.y, cBoardObject_Pellet );
+}
+
+void BoardSimulation::RemovePellet( int x, int y )
+{
+    // Swap the last pellet into the hole
+    const int pelletIndex = m_pelletIndices[ y * m_boardSize + x ];
+    const BoardPosition& lastPellet = m_pellets.back();
+    m_pelletIndices[ lastPellet.y * m_boardSize + lastPellet.x ] = pelletIndex;
+    m_pellets[ pelletIndex ] = lastPellet;
+    m_pellets.pop_back();
+    m_pelletIndices[ y * m_boardSize + x ] = -1;
+}
+
+Error BoardSimulation::MoveSnake( const Move& move )
+{
+    // Compute head position
+    BoardPosition head = GetSnakeHead();
+    if( move == cMove_Up )
+        head.y--;
+    else if( move == cMove_Down )
+        head.y++;
+    else if( move == cMove_Left )
+        head.x--;
+    else if( move == cMove_Right )
+        head.x++;
+    
+    // Bounds check
+    if( head.x < 0 || head.y < 0 || head.x >= m_boardSize || head.y >= m_boardSize )
+    {
+        return cError_OutOfBoard;
+    }
+    
+    bool consumedPellete = false;
+    const int headCell = head.y * m_boardSize + head.x;
+    const uint64_t headBit = uint64_t( 1 ) << ( headCell & 63 );
+    
+    // Self-hit test
+    if( m_snakeCells[ headCell >> 6 ] & headBit )
+    {
+        return cError_SelfEat;
+    }
+    // If we hit a pellet, mark it
+    else if( m_pelletCells[ headCell >> 6 ] & headBit )
+    {
+        m_hungerCount = 0;
+        consumedPellete = true;
+        SetBoard( head.x, head.y, cBoardObject_None );
+        
+        // Remove this pellet from the list
+        m_pelletCount++;
+        RemovePellet( head.x, head.y );
+        
+        // Add a new pellet; it can land on the cell the head is moving into, which covers it for good
+        AddPellet();
+        if( m_pelletIndices[ headCell ] >= 0 )
+        {
+            RemovePellet( head.x, head.y );
+        }
+    }
+    
+    // Moving ahead
+    const int snakeCapacity = m_boardSize * m_boardSize;
+    m_snakeHead = ( m_snakeHead == 0 ) ? ( snakeCapacity - 1 ) : ( m_snakeHead - 1 );
+    m_snakeBody[ m_snakeHead ] = head;
+    m_snakeLength++;
+    SetBoard( head.x, head.y, cBoardObject_Snake );
+    
+    // Remove tail if we haven't consumed a pellet
+    if( consumedPellete == false )
+    {
+        const BoardPosition& oldTail = GetSnake().back();
+        SetBoard( oldTail.x, oldTail.y, cBoardObject_None );
+        m_snakeLength--;
+    }
+    
+    // Special rule: has the snake starved?
+    m_hungerCount++;
+    if( m_hungerCount >= cMaxHunger )
+    {
+        return cError_Starved;
+    }
+    
+    // All done!
+    m_movementCount++;
+    return cError_None;
+}
+
+/*** Simulation Controller ***/
+
+SimSnake::SimSnake( int boardSize, int genePoolCount, uint64_t randomSeed )
+    : m_boardSize( boardSize )
+    , m_activeBoard( NULL )
+    , m_genePool( NULL )
+    , m_snapshotInterval( 10 )
+    , m_islandExchange( NULL )
+    , m_islandIndex( 0 )
+    , m_migrationInterval( 0 )
+    , m_evaluationFarm( NULL )
+    , m_activeGeneIndex( 0 )
+    , m_stepCount( 0 )
+    , m_generationCount( 0 )
+    , m_genePoolSize( genePoolCount )
+    , m_randomSeed( randomSeed )
+    , m_workerCount( 1 )
+    , m_workScheduler( NULL )
+    , m_trialCount( 1 )
+    , m_isIncrementalEvaluation( false )
+    , m_maxMovementCount( 0 )
+    , m_maxPelletEattenCount( 0 )
+    , m_fitnessCacheHitCount( 0 )
+    , m_fitnessCacheMissCount( 0 )
+    , m_reusedGameCount( 0 )
+    , m_resumedGameCount( 0 )
+    , m_steadyReaderCount( 0 )
+    , m_steadyChildTarget( 0 )
+    , m_steadyChildLimit( 0 )
+    , m_steadyStartedCount( 0 )
+    , m_steadyMeasuredCount( 0 )
+    , m_steadyHitCount( 0 )
+    , m_steadyMissCount( 0 )
+    , m_steadyMovementCount( 0 )
+    , m_steadyPelletCount( 0 )
+    , m_isSteadyQuitting( false )
+{
+    // Initialize all gene ranks to -1 (not yet measured)
+    for( int i = 0; i < m_genePoolSize; i++ )
+    {
+        m_geneFitness.push_back( GeneFitnessPair( i, INT_MAX ) );
+    }
+    
+    // Bring the whole population into memory once
+    m_genePool = new GenePool( m_genePoolSize );
+    if( !m_genePool->LoadSnapshot() )
+    {
+        printf( "Error: Unable to load the gene pool \"%s\"; starting from random genes\n", cGenePoolFileName );
+        for( int i = 0; i < m_genePoolSize; i++ )
+        {
+            m_genePool->SetGene( i, Gene(), m_randomSeed );
+        }
+    }
+    
+    // Load for first board game
+    m_activeBoard = new BoardSimulation( boardSize, *m_genePool, 0, GetGameRandom( 0 ) );
+}
+
+SimSnake::~SimSnake()
+{
+    StopSteadyState();
+    delete m_activeBoard;
+    delete m_workScheduler;
+    for( size_t i = 0; i < m_workerBoards.size(); i++ )
+    {
+        delete m_workerBoards[ i ];
+    }
+    for( size_t i = 0; i < m_childDrafts.size(); i++ )
+    {
+        delete m_childDrafts[ i ];
+    }
+    delete m_genePool;
+}
+
+bool SimSnake::SaveGenePool() const
+{
+    // A gene at a time, so steady-state workers only ever wait for one gene to be copied; a
+    // slot a child is being bred into is waited for, so it is saved whole
+    return GenePool::SaveSnapshot( cGenePoolFileName, m_genePoolSize, [this]( int geneIndex, int32_t* words )
+    {
+        std::unique_lock< std::mutex > lock( m_steadyMutex );
+        m_steadyCondition.wait( lock, [&]() { return m_steadyThreads.empty() || m_steadyGeneStates[ geneIndex ] != cSteadyGene_Breeding; } );
+        m_genePool->ReadGene( geneIndex, words );
+    } );
+}
+
+WorkScheduler& SimSnake::GetWorkScheduler()
+{
+    if( m_workScheduler == NULL || m_workScheduler->GetWorkerCount() != m_workerCount )
+    {
+        delete m_workScheduler;
+        m_workScheduler = new WorkScheduler( m_workerCount );
+    }
+    return *m_workScheduler;
+}
+
+void SimSnake::SetIsland( IslandExchange* islandExchange, int islandIndex, int migrationInterval )
+{
+    m_islandExchange = islandExchange;
+    m_islandIndex = islandIndex;
+    m_migrationInterval = migrationInterval;
+}
+
+void SimSnake::Update()
+{
+    StopSteadyState();
+    
+    // Keep repeating until we hit an error or we've moved
+    while( true )
+    {
+        // Update board; runs all non-moving instructions in one go
+        Error errorOut = cError_None;
+        bool hasMoved = m_activeBoard->RunUntilMoved( errorOut, m_stepCount );
+        
         // Error check first
         if( errorOut != cError_None )
         {
-            printf( "Gene has died: \"%s\"\n", ErrorNames[ (int)errorOut ] );
+            printf( "Gene has died: \"%s\"\n", ErrorNames[ (int)errorOut ] );
+            
+            // Save performance
+            m_geneFitness.at( m_activeGeneIndex ) = GeneFitnessPair( m_activeGeneIndex, m_activeBoard->GetFitness() );
+            m_maxMovementCount = std::max( m_maxMovementCount, m_activeBoard->GetMovementCount() );
+            m_maxPelletEattenCount = std::max( m_maxPelletEattenCount, m_activeBoard->GetPelletCount() );
+            
+            // Update gene count; does a gene pool update if we're starting over the group
+            m_activeGeneIndex = ( m_activeGeneIndex + 1 ) % m_genePoolSize;
+            m_stepCount = 0;
+            
+            if( m_activeGeneIndex == 0 )
+            {
+                FitAndBreed();
+                m_generationCount++;
+            }
+            
+            // Start new sim on the next gene
+            m_activeBoard->Reset( *m_genePool, m_activeGeneIndex, GetGameRandom( m_activeGeneIndex ) );
+            
+            break;
+        }
+        
+        // Else, regular update
+        else if( hasMoved )
+        {
+            break;
+        }
+    }
+}
+
+void SimSnake::UpdateGeneration()
+{
+    StopSteadyState();
+    
+    // Games only depend on gene content, so genes measured before (survivors of the last
+    // breeding) start out with the games they already played, and duplicates race only once.
+    // Only a result with every game counts as a hit; one cut short by racing may yet play more
+    std::vector< GeneResult > geneResults( m_genePoolSize );
+    std::vector< int > firstGeneIndices( m_genePoolSize );
+    std::vector< int > contenderIndices;
+    std::unordered_map< uint64_t, int > distinctHashes;
+    for( int i = 0; i < m_genePoolSize; i++ )
+    {
+        const uint64_t geneHash = m_genePool->GetGeneHash( i );
+        std::unordered_map< uint64_t, int >::const_iterator firstGene = distinctHashes.find( geneHash );
+        
+        firstGeneIndices[ i ] = i;
+        if( firstGene != distinctHashes.end() )
+        {
+            firstGeneIndices[ i ] = firstGene->second;
+            m_fitnessCacheHitCount++;
+            continue;
+        }
+        
+        distinctHashes[ geneHash ] = i;
+        contenderIndices.push_back( i );
+        
+        std::unordered_map< uint64_t, GeneResult >::const_iterator cachedResult = m_fitnessCache.find( geneHash );
+        if( cachedResult != m_fitnessCache.end() )
+        {
+            geneResults[ i ] = cachedResult->second;
+        }
+        else
+        {
+            GeneResult emptyResult = { cError_None, 0, 0, 0, 0 };
+            geneResults[ i ] = emptyResult;
+        }
+        
+        if( geneResults[ i ].m_trialCount >= m_trialCount )
+        {
+            m_fitnessCacheHitCount++;
+        }
+        else
+        {
+            m_fitnessCacheMissCount++;
+        }
+    }
+    
+    // Recorded games only matter to genes that can still be parents, which are all in the pool
+    for( std::unordered_map< uint64_t, std::vector< std::shared_ptr< const GameRecord > > >::iterator records = m_gameRecords.begin(); records != m_gameRecords.end(); )
+    {
+        records = ( distinctHashes.count( records->first ) == 0 ) ? m_gameRecords.erase( records ) : std::next( records );
+    }
+    
+    // Successive halving: each round doubles the games of the better half of the field,
+    // which never gets smaller than the half of the pool that breeds. Genes that start out
+    // with more games than a round's only rank on as many as the others have played
+    std::vector< int > geneRoundCounts( m_genePoolSize, 0 );
+    std::vector< int > geneTrialCounts( m_genePoolSize, 0 );
+    const int minContenderCount = std::max( 1, m_genePoolSize / 2 );
+    for( int trialCount = 1, roundCount = 0; ; trialCount = std::min( trialCount * 2, m_trialCount ), roundCount++ )
+    {
+        EvaluateTrials( contenderIndices, trialCount, geneResults );
+        for( size_t i = 0; i < contenderIndices.size(); i++ )
+        {
+            geneRoundCounts[ contenderIndices[ i ] ] = roundCount;
+            geneTrialCounts[ contenderIndices[ i ] ] = trialCount;
+        }
+        
+        if( trialCount >= m_trialCount )
+        {
+            break;
+        }
+        
+        std::stable_sort( contenderIndices.begin(), contenderIndices.end(), [&]( int a, int b ) { return geneResults[ a ].GetFitness( trialCount ) < geneResults[ b ].GetFitness( trialCount ); } );
+        const int contenderCount = int( contenderIndices.size() );
+        contenderIndices.resize( std::min( contenderCount, std::max( minContenderCount, ( contenderCount + 1 ) / 2 ) ) );
+    }
+    
+    // Report in gene order, same as the sequential path would; the cache only keeps
+    // this generation's genes, since only survivors can come back
+    m_fitnessCache.clear();
+    for( int i = 0; i < m_genePoolSize; i++ )
+    {
+        const GeneResult& result = geneResults.at( firstGeneIndices[ i ] );
+        m_fitnessCache[ m_genePool->GetGeneHash( i ) ] = result;
+        m_geneFitness.at( i ) = GeneFitnessPair( i, result.GetFitness( geneTrialCounts[ firstGeneIndices[ i ] ] ), geneRoundCounts[ firstGeneIndices[ i ] ] );
+        
+        printf( "Gene has died: \"%s\"\n", ErrorNames[ (int)result.m_error ] );
+        m_maxMovementCount = std::max( m_maxMovementCount, result.m_movementCount );
+        m_maxPelletEattenCount = std::max( m_maxPelletEattenCount, result.m_pelletCount );
+    }
+    
+    FitAndBreed();
+    m_generationCount++;
+    
+    // Restart the visible board on the first gene of the new generation
+    m_activeGeneIndex = 0;
+    m_stepCount = 0;
+    
+    m_activeBoard->Reset( *m_genePool, 0, GetGameRandom( 0 ) );
+}
+
+void SimSnake::UpdateSteadyState()
+{
+    // Tournaments need a few genes to pick from
+    if( m_genePoolSize < 3 )
+    {
+        UpdateGeneration();
+        return;
+    }
+    
+    // A gene that is playing sits out every tournament, and one another worker breeds from
+    // is never replaced, so there are three genes to every worker
+    const int childCount = m_genePoolSize - m_genePoolSize / 2;
+    const int workerCount = std::max( 1, std::min( m_workerCount, m_genePoolSize / 3 ) );
+    if( int( m_steadyThreads.size() ) != workerCount )
+    {
+        StopSteadyState();
+        StartSteadyState( workerCount );
+    }
+    
+    // Several workers may breed into the next generation, so none waits at the end of this one
+    std::unique_lock< std::mutex > lock( m_steadyMutex );
+    m_steadyChildTarget += childCount;
+    m_steadyChildLimit = m_steadyChildTarget + ( ( workerCount > 1 ) ? childCount : 0 );
+    m_steadyCondition.notify_all();
+    
+    // Migration changes the pool, so nobody may be reading it
+    m_steadyCondition.wait( lock, [&]() { return m_steadyMeasuredCount >= m_steadyChildTarget && m_steadyReaderCount == 0; } );
+    
+    m_fitnessCacheHitCount += m_steadyHitCount;
+    m_fitnessCacheMissCount += m_steadyMissCount;
+    m_maxMovementCount = std::max( m_maxMovementCount, m_steadyMovementCount );
+    m_maxPelletEattenCount = std::max( m_maxPelletEattenCount, m_steadyPelletCount );
+    m_steadyHitCount = 0;
+    m_steadyMissCount = 0;
+    
+    // The cache keeps what is in the pool now, same as after a generation; genes still
+    // playing, or being bred from, are neither ranked nor replaced by migrants
+    std::unordered_map< uint64_t, GeneResult > fitnessCache;
+    std::vector< int > rankedGeneIndices;
+    for( int i = 0; i < m_genePoolSize; i++ )
+    {
+        const uint64_t geneHash = m_genePool->GetGeneHash( i );
+        if( m_fitnessCache.count( geneHash ) != 0 )
+        {
+            fitnessCache[ geneHash ] = m_fitnessCache[ geneHash ];
+        }
+        if( m_steadyGeneStates[ i ] == cSteadyGene_Measured && std::find( m_steadyWorkerParents.begin(), m_steadyWorkerParents.end(), i ) == m_steadyWorkerParents.end() )
+        {
+            rankedGeneIndices.push_back( i );
+        }
+    }
+    m_fitnessCache.swap( fitnessCache );
+    
+    std::stable_sort( rankedGeneIndices.begin(), rankedGeneIndices.end(), [&]( int a, int b ) { return m_geneFitness[ a ].m_fitnessValue < m_geneFitness[ b ].m_fitnessValue; } );
+    std::vector< uint64_t > rankedGeneHashes;
+    for( size_t i = 0; i < rankedGeneIndices.size(); i++ )
+    {
+        rankedGeneHashes.push_back( m_genePool->GetGeneHash( rankedGeneIndices[ i ] ) );
+    }
+    const bool isSnapshotDue = IsSnapshotDue();
+    MigrateGenes( rankedGeneIndices );
+    m_generationCount++;
+    
+    // Migrants get measured (or looked up) before any more children are bred
+    for( size_t i = 0; i < rankedGeneIndices.size(); i++ )
+    {
+        if( m_genePool->GetGeneHash( rankedGeneIndices[ i ] ) != rankedGeneHashes[ i ] )
+        {
+            m_steadyGeneStates[ rankedGeneIndices[ i ] ] = cSteadyGene_Unmeasured;
+        }
+    }
+    
+    // Restart the visible board on the first gene
+    m_activeGeneIndex = 0;
+    m_stepCount = 0;
+    
+    m_activeBoard->Reset( *m_genePool, 0, GetGameRandom( 0 ) );
+    m_steadyCondition.notify_all();
+    lock.unlock();
+    
+    // The workers carry on while it is saved
+    if( isSnapshotDue )
+    {
+        SaveGenePool();
+    }
+}
+
+void SimSnake::StartSteadyState( int workerCount )
+{
+    // Genes the cache knows need not play again; the rest are measured before any breeding
+    m_steadyGeneStates.assign( m_genePoolSize, cSteadyGene_Unmeasured );
+    m_steadyWorkerGenes.assign( workerCount, -1 );
+    m_steadyWorkerParents.assign( workerCount * 2, -1 );
+    m_steadyReaderCount = 0;
+    m_steadyChildTarget = 0;
+    m_steadyChildLimit = 0;
+    m_steadyStartedCount = 0;
+    m_steadyMeasuredCount = 0;
+    m_steadyMovementCount = 0;
+    m_steadyPelletCount = 0;
+    m_isSteadyQuitting = false;
+    
+    if( int( m_workerBoards.size() ) < workerCount )
+    {
+        m_workerBoards.resize( workerCount, NULL );
+    }
+    while( int( m_childDrafts.size() ) < workerCount )
+    {
+        m_childDrafts.push_back( new GeneDraft() );
+    }
+    
+    for( int i = 0; i < workerCount; i++ )
+    {
+        m_steadyThreads.push_back( std::thread( &SimSnake::RunSteadyWorker, this, i ) );
+    }
+}
+
+void SimSnake::StopSteadyState()
+{
+    if( m_steadyThreads.empty() )
+    {
+        return;
+    }
+    
+    // Workers finish the gene they are on; children they did not get to measure stay in the
+    // pool and are measured the usual way
+    {
+        std::lock_guard< std::mutex > lock( m_steadyMutex );
+        m_isSteadyQuitting = true;
+    }
+    m_steadyCondition.notify_all();
+    
+    for( size_t i = 0; i < m_steadyThreads.size(); i++ )
+    {
+        m_steadyThreads[ i ].join();
+    }
+    m_steadyThreads.clear();
+    
+    m_fitnessCacheHitCount += m_steadyHitCount;
+    m_fitnessCacheMissCount += m_steadyMissCount;
+    m_maxMovementCount = std::max( m_maxMovementCount, m_steadyMovementCount );
+    m_maxPelletEattenCount = std::max( m_maxPelletEattenCount, m_steadyPelletCount );
+    m_steadyHitCount = 0;
+    m_steadyMissCount = 0;
+}
+
+void SimSnake::RunSteadyWorker( int workerIndex )
+{
+    const int cTournamentSize = 4;
+    BoardSimulation*& board = m_workerBoards[ workerIndex ];
+    GeneDraft& child = *m_childDrafts[ workerIndex ];
+    
+    // Best (or worst) of cTournamentSize measured genes, bar the given ones; the worst is
+    // never one another worker breeds from
+    auto runTournament = [&]( RandomStream& random, bool isPickingWorst, int excludedIndexA, int excludedIndexB )
+    {
+        int winnerIndex = -1;
+        for( int drawCount = 0; drawCount < cTournamentSize; )
+        {
+            const int geneIndex = random.NextInt( m_genePoolSize );
+            if( m_steadyGeneStates[ geneIndex ] != cSteadyGene_Measured || geneIndex == excludedIndexA || geneIndex == excludedIndexB ||
+                ( isPickingWorst && std::find( m_steadyWorkerParents.begin(), m_steadyWorkerParents.end(), geneIndex ) != m_steadyWorkerParents.end() ) )
+            {
+                continue;
+            }
+            drawCount++;
             
-            // Save performance
-            m_geneFitness.at( m_activeGeneIndex ) = GeneFitnessPair( m_activeGeneIndex, m_activeBoard->GetFitness() );
-            m_maxMovementCount = std::max( m_maxMovementCount, m_activeBoard->GetMovementCount() );
-            m_maxPelletEattenCount = std::max( m_maxPelletEattenCount, m_activeBoard->GetPelletCount() );
+            const int fitness = m_geneFitness[ geneIndex ].m_fitnessValue;
+            if( winnerIndex < 0 || ( isPickingWorst ? ( fitness > m_geneFitness[ winnerIndex ].m_fitnessValue ) : ( fitness < m_geneFitness[ winnerIndex ].m_fitnessValue ) ) )
+            {
+                winnerIndex = geneIndex;
+            }
+        }
+        return winnerIndex;
+    };
+    
+    // Whether another worker is playing a gene with the given content
+    auto isPlaying = [&]( uint64_t geneHash )
+    {
+        for( size_t i = 0; i < m_steadyWorkerGenes.size(); i++ )
+        {
+            if( m_steadyWorkerGenes[ i ] >= 0 && m_genePool->GetGeneHash( m_steadyWorkerGenes[ i ] ) == geneHash )
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    
+    // Reads of the pool done outside the lock; the last one lets a commit or migration go ahead
+    std::unique_lock< std::mutex > lock( m_steadyMutex );
+    auto readPool = [&]( const std::function< void() >& read )
+    {
+        m_steadyReaderCount++;
+        lock.unlock();
+        read();
+        lock.lock();
+        if( --m_steadyReaderCount == 0 )
+        {
+            m_steadyCondition.notify_all();
+        }
+    };
+    
+    while( !m_isSteadyQuitting )
+    {
+        // Genes nobody has measured (the starting pool, migrants) go first, taken from the
+        // cache where it knows them; duplicates of a gene in play wait for its result
+        int geneIndex = -1;
+        bool isUnmeasured = false;
+        for( int i = 0; i < m_genePoolSize && geneIndex < 0; i++ )
+        {
+            if( m_steadyGeneStates[ i ] != cSteadyGene_Unmeasured )
+            {
+                continue;
+            }
             
-            // Update gene count; does a gene pool update if we're starting over the group
-            m_activeGeneIndex = ( m_activeGeneIndex + 1 ) % m_genePoolSize;
-            m_stepCount = 0;
+            const uint64_t geneHash = m_genePool->GetGeneHash( i );
+            std::unordered_map< uint64_t, GeneResult >::const_iterator cachedResult = m_fitnessCache.find( geneHash );
+            if( cachedResult != m_fitnessCache.end() && cachedResult->second.m_trialCount >= m_trialCount )
+            {
+                m_steadyGeneStates[ i ] = cSteadyGene_Measured;
+                m_geneFitness.at( i ) = GeneFitnessPair( i, cachedResult->second.GetFitness( m_trialCount ) );
+                m_steadyHitCount++;
+                continue;
+            }
             
-            if( m_activeGeneIndex == 0 )
+            isUnmeasured = true;
+            if( !isPlaying( geneHash ) )
             {
-                FitAndBreed();
-                m_generationCount++;
+                geneIndex = i;
             }
+        }
+        
+        // Otherwise a child, once every gene is measured and the caller allows for one more
+        const bool isChild = ( geneIndex < 0 );
+        if( isChild )
+        {
+            if( isUnmeasured || m_steadyStartedCount >= m_steadyChildLimit )
+            {
+                m_steadyCondition.wait( lock );
+                continue;
+            }
+            
+            // Each child has its own stream, but what it picks depends on the pool at the time
+            RandomStream random( m_randomSeed, cRandomStream_SteadyState, m_steadyStartedCount++ );
+            const int geneIndexA = runTournament( random, false, -1, -1 );
+            const int geneIndexB = runTournament( random, false, geneIndexA, -1 );
+            geneIndex = runTournament( random, true, geneIndexA, geneIndexB );
+            m_steadyGeneStates[ geneIndex ] = cSteadyGene_Breeding;
+            m_steadyWorkerParents[ workerIndex * 2 ] = geneIndexA;
+            m_steadyWorkerParents[ workerIndex * 2 + 1 ] = geneIndexB;
             
-            // Load next gene
-            char fileName[ 512 ];
-            GetGeneName( m_activeGeneIndex, fileName );
+            // Only the commit is done under the lock, once nobody is reading the pool; the
+            // parents stay put until the child's words are written
+            readPool( [&]() { Breed( geneIndexA, geneIndexB, random, child ); } );
+            m_steadyCondition.wait( lock, [&]() { return m_steadyReaderCount == 0; } );
+            m_genePool->CommitDraft( child, geneIndex );
+            readPool( [&]() { m_genePool->WriteDraft( child ); } );
             
-            // Stap to next gene
-            Gene nextGene;
-            LoadGene( fileName, nextGene );
+            m_steadyWorkerParents[ workerIndex * 2 ] = -1;
+            m_steadyWorkerParents[ workerIndex * 2 + 1 ] = -1;
+            m_steadyCondition.notify_all();
+        }
+        m_steadyGeneStates[ geneIndex ] = cSteadyGene_Playing;
+        m_steadyWorkerGenes[ workerIndex ] = geneIndex;
+        const uint64_t geneHash = m_genePool->GetGeneHash( geneIndex );
+        
+        // Nobody else touches the slot until it is measured, so later trials just restart;
+        // loading only needs the rest of the pool left alone
+        GeneResult result = { cError_None, 0, 0, 0, 0 };
+        for( int trialIndex = 0; trialIndex < m_trialCount; trialIndex++ )
+        {
+            const RandomStream gameRandom = GetGameRandom( m_randomSeed, m_isIncrementalEvaluation ? 0 : geneHash, trialIndex );
+            if( board == NULL )
+            {
+                board = new BoardSimulation( m_boardSize, *m_genePool, geneIndex, gameRandom );
+            }
+            else if( trialIndex > 0 )
+            {
+                board->Restart( gameRandom );
+            }
+            else
+            {
+                board->Reset( *m_genePool, geneIndex, gameRandom );
+            }
             
-            // Start new sim
-            delete m_activeBoard;
-            m_activeBoard = new BoardSimulation( m_boardSize, nextGene );
+            lock.unlock();
+            const Error error = board->RunUntilDeath();
+            lock.lock();
             
-            break;
+            if( trialIndex == 0 )
+            {
+                result.m_error = error;
+            }
+            result.m_fitnessSum += board->GetFitness();
+            result.m_trialCount++;
+            result.m_trialFitness.push_back( board->GetFitness() );
+            result.m_movementCount = std::max( result.m_movementCount, board->GetMovementCount() );
+            result.m_pelletCount = std::max( result.m_pelletCount, board->GetPelletCount() );
         }
         
-        // Else, regular update
+        // The gene enters tournaments as soon as it is measured
+        m_fitnessCache[ geneHash ] = result;
+        m_geneFitness.at( geneIndex ) = GeneFitnessPair( geneIndex, result.GetFitness() );
+        m_steadyGeneStates[ geneIndex ] = cSteadyGene_Measured;
+        m_steadyWorkerGenes[ workerIndex ] = -1;
+        m_steadyMeasuredCount += isChild ? 1 : 0;
+        m_steadyMissCount++;
+        
+        printf( "Gene has died: \"%s\"\n", ErrorNames[ (int)result.m_error ] );
+        m_steadyMovementCount = std::max( m_steadyMovementCount, result.m_movementCount );
+        m_steadyPelletCount = std::max( m_steadyPelletCount, result.m_pelletCount );
+        m_steadyCondition.notify_all();
+    }
+}
+
+void SimSnake::EvaluateTrials( const std::vector< int >& geneIndices, int trialCount, std::vector< GeneResult >& geneResults )
+{
+    // One game per gene and trial still to play, in gene order
+    std::vector< std::pair< int, int > > trials;
+    for( size_t i = 0; i < geneIndices.size(); i++ )
+    {
+        for( int trialIndex = geneResults[ geneIndices[ i ] ].m_trialCount; trialIndex < trialCount; trialIndex++ )
+        {
+            trials.push_back( std::make_pair( geneIndices[ i ], trialIndex ) );
+        }
+    }
+    
+    // Adds a game's outcome to its gene's result
+    auto addTrialResult = [&]( const std::pair< int, int >& trial, const GeneResult& trialResult )
+    {
+        GeneResult& result = geneResults[ trial.first ];
+        if( trial.second == 0 )
+        {
+            result.m_error = trialResult.m_error;
+        }
+        result.m_fitnessSum += trialResult.m_fitnessSum;
+        result.m_trialCount++;
+        result.m_trialFitness.push_back( trialResult.m_fitnessSum );
+        result.m_movementCount = std::max( result.m_movementCount, trialResult.m_movementCount );
+        result.m_pelletCount = std::max( result.m_pelletCount, trialResult.m_pelletCount );
+    };
+    
+    // One work item per gene's games, handed out by the scheduler; each writes only its
+    // own games' results
+    const int pendingCount = int( trials.size() );
+    std::vector< int > workItems;
+    for( int i = 0; i < pendingCount; i++ )
+    {
+        if( i == 0 || trials[ i ].first != trials[ i - 1 ].first )
+        {
+            workItems.push_back( i );
+        }
+    }
+    workItems.push_back( pendingCount );
+    
+    const int workItemCount = int( workItems.size() ) - 1;
+    const int workerCount = std::max( 1, std::min( m_workerCount, workItemCount ) );
+    std::vector< GeneResult > trialResults( pendingCount );
+    std::vector< char > isPlayedHere( pendingCount, 0 );
+    
+    // A game is played by whoever claims it first: the farm's workers (see EvaluationFarm.h),
+    // if any are connected, take games from the front while the local workers take them from
+    // the back, and whatever the farm claimed but could not play is played here afterwards
+    std::vector< std::atomic< bool > > isClaimed( pendingCount );
+    for( int i = 0; i < pendingCount; i++ )
+    {
+        isClaimed[ i ] = false;
+    }
+    
+    std::vector< EvaluationFarm::Game > games;
+    std::vector< EvaluationFarm::GameResult > gameResults( pendingCount );
+    std::thread farmThread;
+    if( m_evaluationFarm != NULL && pendingCount > 0 )
+    {
+        m_evaluationFarm->AcceptWorkers();
+        if( m_evaluationFarm->GetWorkerCount() > 0 )
+        {
+            for( int i = 0; i < pendingCount; i++ )
+            {
+                EvaluationFarm::Game game = { trials[ i ].first, trials[ i ].second };
+                games.push_back( game );
+            }
+            
+            farmThread = std::thread( [&]()
+            {
+                m_evaluationFarm->Evaluate( *m_genePool, m_randomSeed, m_boardSize, m_isIncrementalEvaluation, games, gameResults, [&]( int gameIndex ) { return !isClaimed[ gameIndex ].exchange( true ); } );
+            } );
+        }
+    }
+    
+    // Incremental evaluation records every game it plays; a child's game is looked up among
+    // the games of the gene it was drafted from, which is still in the pool if it was recorded
+    const bool isRecording = m_isIncrementalEvaluation;
+    std::vector< std::shared_ptr< const GameRecord > > parentRecords( pendingCount );
+    std::vector< std::shared_ptr< const GameRecord > > trialRecords( pendingCount );
+    std::vector< int > parentIndices( pendingCount, -1 );
+    std::atomic< int > reusedCount( 0 ), resumedCount( 0 );
+    if( isRecording )
+    {
+        std::unordered_map< uint64_t, int > hashIndices;
+        for( int i = m_genePoolSize - 1; i >= 0; i-- )
+        {
+            hashIndices[ m_genePool->GetGeneHash( i ) ] = i;
+        }
+        
+        for( int i = 0; i < pendingCount; i++ )
+        {
+            std::unordered_map< uint64_t, uint64_t >::const_iterator parentHash = m_parentHashes.find( m_genePool->GetGeneHash( trials[ i ].first ) );
+            if( parentHash == m_parentHashes.end() || hashIndices.count( parentHash->second ) == 0 || m_gameRecords.count( parentHash->second ) == 0 )
+            {
+                continue;
+            }
+            
+            const std::vector< std::shared_ptr< const GameRecord > >& records = m_gameRecords[ parentHash->second ];
+            if( trials[ i ].second < int( records.size() ) )
+            {
+                parentRecords[ i ] = records[ trials[ i ].second ];
+                parentIndices[ i ] = hashIndices[ parentHash->second ];
+            }
+        }
+    }
+    
+    // Every worker keeps its own simulation across genes and generations, and only resets it
+    if( int( m_workerBoards.size() ) < workerCount )
+    {
+        m_workerBoards.resize( workerCount, NULL );
+    }
+    
+    // A simulation that just played a game of the same gene only restarts, which keeps
+    // its decoded code; otherwise only the chunks the new gene does not share get copied
+    std::vector< int > boardGeneIndices( m_workerBoards.size(), -1 );
+    
+    auto playTrial = [&]( int trialIndex, int workerIndex )
+    {
+        BoardSimulation*& board = m_workerBoards[ workerIndex ];
+        int& boardGeneIndex = boardGeneIndices[ workerIndex ];
+        isPlayedHere[ trialIndex ] = 1;
+        
+        // A game that never reads a word the child changed is the parent's game
+        const GameRecord* parentRecord = parentRecords[ trialIndex ].get();
+        const int changeSnapshotCount = ( parentRecord != NULL ) ? parentRecord->FindFirstChange( *m_genePool, trials[ trialIndex ].first, parentIndices[ trialIndex ] ) : 0;
+        if( changeSnapshotCount < 0 )
+        {
+            GeneResult result = { parentRecord->m_error, parentRecord->m_fitness, 1, parentRecord->m_movementCount, parentRecord->m_pelletCount };
+            trialResults[ trialIndex ] = result;
+            trialRecords[ trialIndex ] = parentRecords[ trialIndex ];
+            reusedCount++;
+            return;
+        }
+        
+        const int geneIndex = trials[ trialIndex ].first;
+        const RandomStream random = GetGameRandom( geneIndex, trials[ trialIndex ].second );
+        if( board == NULL )
+        {
+            board = new BoardSimulation( m_boardSize, *m_genePool, geneIndex, random );
+        }
+        else if( boardGeneIndex == geneIndex )
+        {
+            board->Restart( random );
+        }
         else
         {
-            if( hasMoved )
+            board->Reset( *m_genePool, geneIndex, random );
+        }
+        boardGeneIndex = geneIndex;
+        
+        Error error = cError_None;
+        if( isRecording )
+        {
+            // Otherwise it picks up from the last snapshot before that read, if any
+            std::shared_ptr< GameRecord > record = std::make_shared< GameRecord >();
+            if( changeSnapshotCount > 0 )
             {
-                m_stepCount = 0;
-                break;
+                error = board->ResumeUntilDeath( *parentRecord, changeSnapshotCount - 1, *record );
+                resumedCount++;
             }
             else
             {
-                m_stepCount++;
+                error = board->RecordUntilDeath( *record );
+            }
+            trialRecords[ trialIndex ] = record;
+        }
+        else
+        {
+            error = board->RunUntilDeath();
+        }
+        
+        GeneResult result = { error, board->GetFitness(), 1, board->GetMovementCount(), board->GetPelletCount() };
+        trialResults[ trialIndex ] = result;
+    };
+    
+    // Genes from the back; within a gene, games in order so a simulation only restarts
+    auto workItemFunc = [&]( int taskIndex, int workerIndex )
+    {
+        const int workItem = workItemCount - 1 - taskIndex;
+        for( int trialIndex = workItems[ workItem ]; trialIndex < workItems[ workItem + 1 ]; trialIndex++ )
+        {
+            if( !isClaimed[ trialIndex ].exchange( true ) )
+            {
+                playTrial( trialIndex, workerIndex );
+            }
+        }
+    };
+    GetWorkScheduler().Run( workItemCount, workItemFunc, workerCount );
+    
+    if( farmThread.joinable() )
+    {
+        farmThread.join();
+        
+        std::vector< int > unplayedTrials;
+        for( int i = 0; i < pendingCount; i++ )
+        {
+            if( !isPlayedHere[ i ] && !gameResults[ i ].m_isPlayed )
+            {
+                unplayedTrials.push_back( i );
+            }
+        }
+        
+        auto unplayedFunc = [&]( int taskIndex, int workerIndex ) { playTrial( unplayedTrials[ taskIndex ], workerIndex ); };
+        GetWorkScheduler().Run( int( unplayedTrials.size() ), unplayedFunc, workerCount );
+        
+        for( int i = 0; i < pendingCount; i++ )
+        {
+            if( !isPlayedHere[ i ] )
+            {
+                GeneResult result = { gameResults[ i ].m_error, gameResults[ i ].m_fitness, 1, gameResults[ i ].m_movementCount, gameResults[ i ].m_pelletCount };
+                trialResults[ i ] = result;
             }
         }
     }
+    
+    // Fold in, in the same order whatever the worker count
+    for( int i = 0; i < pendingCount; i++ )
+    {
+        addTrialResult( trials[ i ], trialResults[ i ] );
+    }
+    
+    for( int i = 0; i < pendingCount; i++ )
+    {
+        if( trialRecords[ i ] != NULL )
+        {
+            std::vector< std::shared_ptr< const GameRecord > >& records = m_gameRecords[ m_genePool->GetGeneHash( trials[ i ].first ) ];
+            records.resize( std::max( records.size(), size_t( trials[ i ].second + 1 ) ) );
+            records[ trials[ i ].second ] = trialRecords[ i ];
+        }
+    }
+    m_reusedGameCount += reusedCount;
+    m_resumedGameCount += resumedCount;
 }
 
 void SimSnake::GetStats( int& longestLivedMovementCount, int& mostPelletsEatenCount ) const
@@ -831,49 +2903,112 @@ void SimSnake::GetStats( int& longestLivedMovementCount, int& mostPelletsEatenCo
     mostPelletsEatenCount = m_maxPelletEattenCount;
 }
 
+void SimSnake::GetFitnessCacheStats( int& hitCount, int& missCount ) const
+{
+    hitCount = m_fitnessCacheHitCount;
+    missCount = m_fitnessCacheMissCount;
+}
+
+int SimSnake::GetWorkerUtilization() const
+{
+    return ( m_workScheduler != NULL ) ? m_workScheduler->GetUtilization() : 100;
+}
+
+void SimSnake::GetIncrementalStats( int& reusedCount, int& resumedCount ) const
+{
+    reusedCount = m_reusedGameCount;
+    resumedCount = m_resumedGameCount;
+}
+
 void SimSnake::FitAndBreed()
 {
     // Sort gene scores, lower is best; dead genes are ranked with int_max
     std::sort( m_geneFitness.begin(), m_geneFitness.end(), GeneFitnessSortFunc );
     const int cHalfPoolSize = m_genePoolSize / 2;
     
-    // Copy the top best genes into their new file names
-    std::vector< Gene > bestGenes;
+    // Move the top best genes into the first slots, in rank order
+    std::vector< int > bestGeneIndices;
     for( int i = 0; i < cHalfPoolSize; i++ )
     {
-        Gene gene;
-        int geneIndex = m_geneFitness.at( i ).m_geneIndex;
-        
-        char fileName[ 512 ];
-        GetGeneName( geneIndex, fileName );
-        
-        if( !LoadGene( fileName, gene ) )
+        bestGeneIndices.push_back( m_geneFitness.at( i ).m_geneIndex );
+    }
+    m_genePool->Reorder( bestGeneIndices );
+    
+    // Top 50% replicate with the next ranked gene, replacing bottom 50%; self-breeding
+    // results in mutation
+    const int childCount = m_genePoolSize - cHalfPoolSize;
+    auto getParents = [&]( int childIndex, int& geneIndexA, int& geneIndexB )
+    {
+        const int i = childIndex & ~1;
+        geneIndexA = i;
+        geneIndexB = (i + 1) % m_genePoolSize;
+        if( ( childIndex & 1 ) != 0 )
         {
-            printf( "Error: Unable to load the gene at index %d for re-sorting\n", geneIndex );
+            std::swap( geneIndexA, geneIndexB );
         }
-        
-        bestGenes.push_back( gene );
-    }
+    };
     
-    // Write out this list, nuking the original set
-    for( int i = 0; i < cHalfPoolSize; i++ )
+    // Children are drafted in parallel off the pool, then go in one at a time, in order, and
+    // finally have their words written in parallel again. A child with a parent bred this
+    // round (only with odd half sizes) waits for a second pass, after its parent
+    auto isInPass = [&]( int childIndex, int pass )
+    {
+        int geneIndexA = 0, geneIndexB = 0;
+        getParents( childIndex, geneIndexA, geneIndexB );
+        return ( std::max( geneIndexA, geneIndexB ) >= cHalfPoolSize ) == ( pass == 1 );
+    };
+    
+    while( int( m_childDrafts.size() ) < childCount )
     {
-        char fileName[ 512 ];
-        GetGeneName( i, fileName );
-        WriteGene( fileName, bestGenes.at( i ) );
+        m_childDrafts.push_back( new GeneDraft() );
     }
+    m_parentHashes.clear();
     
-    // Top 50% replicate with the next ranked gene, replacing bottom 50%
-    for( int i = 0; i < cHalfPoolSize; i += 2 )
+    for( int pass = 0; pass < 2; pass++ )
     {
-        int geneIndex = m_geneFitness.at( i ).m_geneIndex;
-        
-        // Self-breeding results in mutation
-        int geneIndexA = geneIndex;
-        int geneIndexB = (geneIndex + 1) % m_genePoolSize;
-        
-        Breed( geneIndexA, geneIndexB, cHalfPoolSize + geneIndex );
-        Breed( geneIndexB, geneIndexA, cHalfPoolSize + geneIndex + 1 );
+        for( int stage = 0; stage < 2; stage++ )
+        {
+            auto breedFunc = [&]( int childIndex, int /*workerIndex*/ )
+            {
+                if( !isInPass( childIndex, pass ) )
+                {
+                    return;
+                }
+                
+                if( stage == 0 )
+                {
+                    int geneIndexA = 0, geneIndexB = 0;
+                    getParents( childIndex, geneIndexA, geneIndexB );
+                    Breed( geneIndexA, geneIndexB, cHalfPoolSize + childIndex, *m_childDrafts[ childIndex ] );
+                }
+                else
+                {
+                    m_genePool->WriteDraft( *m_childDrafts[ childIndex ] );
+                }
+            };
+            
+            // A worker has to have a few children to be worth waking, and the second pass
+            // is a child or two at most
+            const int cMinThreadChildCount = 16;
+            const int workerCount = ( pass == 0 ) ? std::min( m_workerCount, childCount / cMinThreadChildCount ) : 1;
+            GetWorkScheduler().Run( childCount, breedFunc, workerCount );
+            
+            for( int childIndex = 0; childIndex < childCount && stage == 0; childIndex++ )
+            {
+                if( isInPass( childIndex, pass ) )
+                {
+                    m_genePool->CommitDraft( *m_childDrafts[ childIndex ], cHalfPoolSize + childIndex );
+                    
+                    // Children start out as their B parent (see Breed()), so that is the one to resume from
+                    int geneIndexA = 0, geneIndexB = 0;
+                    getParents( childIndex, geneIndexA, geneIndexB );
+                    if( m_isIncrementalEvaluation )
+                    {
+                        m_parentHashes[ m_genePool->GetGeneHash( cHalfPoolSize + childIndex ) ] = m_genePool->GetGeneHash( geneIndexB );
+                    }
+                }
+            }
+        }
     }
     
     printf( "Breeding and generatng a population\n" );
@@ -883,60 +3018,95 @@ void SimSnake::FitAndBreed()
     {
         m_geneFitness.at( i ) = GeneFitnessPair( i, 0 );
     }
+    
+    // Survivors rank first, in order, and newcomers take the place of the last children
+    std::vector< int > rankedGeneIndices;
+    for( int i = 0; i < m_genePoolSize; i++ )
+    {
+        rankedGeneIndices.push_back( i );
+    }
+    EndGeneration( rankedGeneIndices );
 }
 
-void SimSnake::Breed( int geneIndexA, int geneIndexB, int geneReplacementIndex )
+void SimSnake::EndGeneration( const std::vector< int >& rankedGeneIndices )
 {
-    char fileName[ 512 ];
-    
-    // Load both genes; remember that the A gene will be dominant here
-    GetGeneName( geneIndexA, fileName );
-    Gene geneA;
-    LoadGene( fileName, geneA );
+    MigrateGenes( rankedGeneIndices );
     
-    GetGeneName( geneIndexB, fileName );
-    Gene geneB;
-    LoadGene( fileName, geneB );
-    
-    if( geneA.empty() || geneB.empty() )
+    // Periodic snapshot; the generation count is bumped by our caller
+    if( IsSnapshotDue() )
     {
-        printf( "Internal error: gene length inconsistency!\n" );
-        return;
+        SaveGenePool();
     }
-    
-    Gene childGene = geneB;
+}
+
+void SimSnake::MigrateGenes( const std::vector< int >& rankedGeneIndices )
+{
+    // Only ever the better half goes out
+    if( m_islandExchange != NULL && m_migrationInterval > 0 && ( m_generationCount + 1 ) % m_migrationInterval == 0 )
+    {
+        const int geneCount = int( rankedGeneIndices.size() );
+        const int migrantCount = std::min( int( IslandExchange::cMigrantCount ), geneCount / 2 );
+        std::vector< int > emigrantIndices, immigrantIndices;
+        for( int i = 0; i < migrantCount; i++ )
+        {
+            emigrantIndices.push_back( rankedGeneIndices[ i ] );
+            immigrantIndices.push_back( rankedGeneIndices[ geneCount - migrantCount + i ] );
+        }
+        
+        m_islandExchange->Publish( m_islandIndex, *m_genePool, emigrantIndices );
+        const int immigrantCount = m_islandExchange->Receive( m_islandIndex, *m_genePool, immigrantIndices );
+        printf( "Island %d sent %d genes, received %d\n", m_islandIndex, migrantCount, immigrantCount );
+    }
+}
+
+void SimSnake::Breed( int geneIndexA, int geneIndexB, int geneReplacementIndex, GeneDraft& child ) const
+{
+    // Each child has its own stream, so breeding order does not matter
+    RandomStream random( m_randomSeed, cRandomStream_Breed, m_generationCount, geneReplacementIndex );
+    Breed( geneIndexA, geneIndexB, random, child );
+}
+
+void SimSnake::Breed( int geneIndexA, int geneIndexB, RandomStream& random, GeneDraft& child ) const
+{
+    // Remember that the A gene will be dominant here; the child starts out as gene B,
+    // and is put together as a draft so the pool keeps its hash current
+    m_genePool->StartDraft( child, geneIndexB );
     
     // We cut up based on this division:
     const int cSegmentCount = 128;
-    const int cSelectionLength = cMemorySize / cSegmentCount;
+    static_assert( cMemorySize / cSegmentCount == GenePool::cSegmentWords, "Breeding chunks must be gene pool segments" );
     
     // Swap up to three chunks at a time
     const int cChunkCount = 5;
-    const int cChunkNum = (rand() % cChunkCount) + 1;
+    const int cChunkNum = random.NextInt( cChunkCount ) + 1;
     
     // Shuffle genes from either self or given B gene
     for( int chunk = 0; chunk < cChunkNum * 2; chunk++ )
     {
         // 2x because 0 - cSegmentCount is gene A, cSegmentCount - cSegmentCount * 2 is gene B
-        int sourceIndex = rand() % (cSegmentCount * 2);
-        int destIndex = rand() % cSegmentCount;
+        int sourceIndex = random.NextInt( cSegmentCount * 2 );
+        int destIndex = random.NextInt( cSegmentCount );
         
         // Swap the chunk's instructions
-        for( int i = 0; i < cSelectionLength; i++ )
-        {
-            Gene& srcGene = ( sourceIndex >= cSegmentCount ) ? geneA : geneB;
-            childGene.at( destIndex * cSelectionLength + i ) = srcGene.at( (sourceIndex % cSegmentCount) * cSelectionLength + i );
-        }
+        const int sourceGeneIndex = ( sourceIndex >= cSegmentCount ) ? geneIndexA : geneIndexB;
+        m_genePool->DraftSegment( child, sourceGeneIndex, sourceIndex % cSegmentCount, destIndex );
     }
     
     // Mutate 0.01% of data
     const int cMutationCount = int( float( cMemorySize ) * 0.0001f );
     for( int i = 0; i < cMutationCount; i++ )
     {
-        childGene.at( rand() % cMemorySize ) = int32_t(rand() % INT32_MAX);
+        const int address = random.NextInt( cMemorySize );
+        m_genePool->DraftWord( child, address, random.NextWord() );
     }
-    
-    // Write out
-    GetGeneName( geneReplacementIndex, fileName );
-    WriteGene( fileName, childGene );
+}
+
+RandomStream SimSnake::GetGameRandom( int geneIndex, int trialIndex ) const
+{
+    return GetGameRandom( m_randomSeed, m_isIncrementalEvaluation ? 0 : m_genePool->GetGeneHash( geneIndex ), trialIndex );
+}
+
+RandomStream SimSnake::GetGameRandom( uint64_t randomSeed, uint64_t geneHash, int trialIndex )
+{
+    return RandomStream( randomSeed, cRandomStream_Game, geneHash, uint64_t( trialIndex ) );
 }
@@ -39,6 +39,14 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "RandomStream.h"
 
 /*** Config Constants ***/
 
@@ -53,6 +61,9 @@ static const int cMaxHunger = 500; // Want to make them convert to optimal
 // Stalls after executing n-number of instructions with no movement
 static const int cStallCount = 10000;
 
+// Zeroed words allocated past the end of a simulation's memory
+static const int cMemoryGuardCount = 2;
+
 /*** Common Structures ***/
 
 // Instruction are multi-word
@@ -63,7 +74,7 @@ enum Instruction
     cInstruction_ZeroA,     // a = 0
     cInstruction_ZeroB,     // b = 0
     cInstruction_GetPos,    // a = x, b = y; xy are snake head pos
-    cInstruction_Board,     // a = board[b][a]
+    cInstruction_Board,     // a = board[b][a]; a wall (3) off the board
     cInstruction_BSize,     // a = board-size
     cInstruction_SetA,      // a = <literal>
     cInstruction_SetB,      // b = <literal>
@@ -170,8 +181,8 @@ static const char* ErrorNames[ cErrorCount ] =
 // Gene and size of each memory unit; 1MB
 typedef std::vector< int32_t > Gene;
 
-// Serialize to/from text file
-bool WriteGene( const char* fileName, const Gene& gene );
+// Serialize to/from text file; padding is drawn from the seed's padding stream
+bool WriteGene( const char* fileName, const Gene& gene, uint64_t randomSeed = 0 );
 bool LoadGene( const char* fileName, Gene& gene );
 
 // Lodas the human-readable txt file; comments start with semi-colon,
@@ -190,6 +201,97 @@ struct BoardPosition
     int x, y;
 };
 
+// Read-only view of the snake body, which lives in a ring buffer; index 0 is the head
+class SnakeView
+{
+public:
+    
+    SnakeView( const BoardPosition* body, int capacity, int headIndex, int length )
+        : m_body( body ), m_capacity( capacity ), m_headIndex( headIndex ), m_length( length ) { }
+    
+    int size() const { return m_length; }
+    
+    const BoardPosition& operator[]( int index ) const
+    {
+        const int bodyIndex = m_headIndex + index;
+        return m_body[ ( bodyIndex >= m_capacity ) ? ( bodyIndex - m_capacity ) : bodyIndex ];
+    }
+    
+    const BoardPosition& front() const { return m_body[ m_headIndex ]; }
+    const BoardPosition& back() const { return ( *this )[ m_length - 1 ]; }
+    
+private:
+    
+    const BoardPosition* m_body;
+    int m_capacity;
+    int m_headIndex;
+    int m_length;
+};
+
+class CodeCache;
+class GenePool;
+struct GeneDraft;
+class IslandExchange;
+class EvaluationFarm;
+class WorkScheduler;
+
+// What one game of a gene did, so that the same game (same pellet stream) of a similar
+// gene can pick up where the two first differ, see BoardSimulation::ResumeUntilDeath()
+struct GameRecord
+{
+    // Words the game read or executed, in the order they were first read, and how many
+    // snapshots had been taken by then; words first read together are kept as one range
+    struct ReadRange
+    {
+        int32_t m_address;
+        int32_t m_wordCount;
+        int32_t m_snapshotCount;
+    };
+    
+    // Every write the game made, even those that did not change the word, since the
+    // other gene may hold something else there
+    struct MemoryWrite
+    {
+        int32_t m_address;
+        int32_t m_value;
+    };
+    
+    // Everything that changes during a game, right after a move; the board is kept as
+    // its lists only, the bitboards and indices follow from them
+    struct Snapshot
+    {
+        int32_t m_instructionPtr;
+        int m_registerA, m_registerB;
+        int m_instructionCount;
+        int m_movementCount;
+        int m_pelletCount;
+        int m_hungerCount;
+        int m_writeCount;
+        RandomStream m_random;
+        std::vector< BoardPosition > m_snake;
+        std::vector< BoardPosition > m_pellets;
+        std::vector< int32_t > m_freeCells;
+    };
+    
+    std::vector< ReadRange > m_reads;
+    std::vector< Snapshot > m_snapshots;
+    std::vector< MemoryWrite > m_writes;
+    
+    // Set once writes stopped being kept; no snapshot is taken after that
+    bool m_isMissingWrites;
+    
+    // How the game ended
+    Error m_error;
+    int m_fitness;
+    int m_instructionCount;
+    int m_movementCount;
+    int m_pelletCount;
+    
+    // Number of snapshots taken before the game first read a word on which the two genes
+    // of the pool differ, or -1 if it never did, in which case both play this game the same
+    int FindFirstChange( const GenePool& genePool, int geneIndex, int otherGeneIndex ) const;
+};
+
 // A board game that simulates a gene
 // Pellets are randomly placed
 // Todo: different patterns
@@ -202,25 +304,64 @@ public:
         cBoardObject_None,
         cBoardObject_Snake,
         cBoardObject_Pellet,
+        cBoardObject_Wall,      // anything off the board
     };
     
-    // Snake always starts at center
-    BoardSimulation( int worldSize, const Gene& gene );
+    // Snake always starts at center; pellets are placed from the given stream, so
+    // the same gene and stream always play the same game
+    BoardSimulation( int worldSize, const Gene& gene, const RandomStream& random = RandomStream() );
+    BoardSimulation( int worldSize, const int32_t* gene, int geneLength, const RandomStream& random = RandomStream() );
+    BoardSimulation( int worldSize, const GenePool& genePool, int geneIndex, const RandomStream& random = RandomStream() );
     ~BoardSimulation();
     
+    // Starts over on another gene, same as constructing a new simulation but reusing
+    // every allocation; from a pool, only the chunks (see GenePool.h) that differ from
+    // what memory already holds get copied
+    void Reset( const int32_t* gene, int geneLength, const RandomStream& random = RandomStream() );
+    void Reset( const GenePool& genePool, int geneIndex, const RandomStream& random = RandomStream() );
+    
+    // Starts over on the same gene (and stream, unless given another), only restoring the
+    // memory pages that were written; code decoded from words the game did not change is
+    // kept, so more games of one gene share it. The gene itself must not have changed
+    // since it was loaded
+    void Restart() { Restart( m_random ); }
+    void Restart( const RandomStream& random );
+    
     // Get size
     int GetBoardSize() const { return m_boardSize; }
     
-    // Get back the state of the board
-    BoardObject GetBoard( int x, int y ) const;
+    // Get back the state of the board; setting also keeps the free-cell index current.
+    // Genes can ask for any position, so everything off the board reads as a wall
+    BoardObject GetBoard( int x, int y ) const
+    {
+        if( unsigned( x ) >= unsigned( m_boardSize ) || unsigned( y ) >= unsigned( m_boardSize ) )
+        {
+            return cBoardObject_Wall;
+        }
+        
+        // A cell is never both, so the two bits spell out the BoardObject value
+        const int cell = y * m_boardSize + x;
+        const int shift = cell & 63;
+        return BoardObject( ( ( m_snakeCells[ cell >> 6 ] >> shift ) & 1 ) | ( ( ( m_pelletCells[ cell >> 6 ] >> shift ) & 1 ) << 1 ) );
+    }
     void SetBoard( int x, int y, const BoardObject& boardObj );
     
     // Executes one instruction, returns true on movement of snake
     // Any errors are given through "errorOut"
     bool UpdateSimulation( Error& errorOut );
     
-    // Returns the array of snake positions; starts from head to tail
-    const std::vector< BoardPosition >& GetSnake() const { return m_snake; }
+    // Executes instructions until the snake moves or the gene dies, returns true
+    // on movement of snake; same results as calling UpdateSimulation() in a loop
+    // with SimSnake's stall rule, where "stepCount" is the number of instructions
+    // since the last move (updated in place, reset on movement). Runs from cached
+    // decoded blocks with threaded dispatch, and only checks for limits where
+    // they can actually change
+    bool RunUntilMoved( Error& errorOut, int& stepCount );
+    
+    // Returns the snake positions; starts from head to tail
+    SnakeView GetSnake() const { return SnakeView( m_snakeBody, m_boardSize * m_boardSize, m_snakeHead, m_snakeLength ); }
+    
+    // Returns the pellets on the board, in no particular order
     const std::vector< BoardPosition >& GetPellets() const { return m_pellets; }
     
     // Exposed fitness values; smaller is better
@@ -230,10 +371,29 @@ public:
     int GetMovementCount() const { return int( m_movementCount ); }
     int GetPelletCount() const { return int( m_pelletCount ); }
     
+    // Keeps executing until the gene dies, applying the same stall rule as
+    // SimSnake::Update(); returns the cause of death. A snake that comes back to
+    // an earlier state without eating repeats itself until it starves, so whole
+    // repetitions are skipped; the counts still match running them
+    Error RunUntilDeath();
+    
+    // Same as RunUntilDeath(), also recording what the game did (see GameRecord). Snapshots
+    // are taken after moves, each at twice the instruction count of the last, so a game
+    // resumed from one never redoes more than half of what came before it
+    Error RecordUntilDeath( GameRecord& record );
+    
+    // Plays the game of the given record on the gene loaded now, starting from the record's
+    // snapshot instead of the beginning, and records it too; the simulation must have just
+    // been reset (or restarted) with the record's stream, and the game must not have read
+    // any word on which the genes differ before the snapshot was taken. Gives the same
+    // result as RunUntilDeath()
+    Error ResumeUntilDeath( const GameRecord& fromRecord, int snapshotIndex, GameRecord& record );
+    
 protected:
     
-    // Randomly place in the board
+    // Randomly place in the board, on any free cell; a full board gets no pellet
     void AddPellet();
+    void RemovePellet( int x, int y );
     
     // Snake wants to move in a given direction
     enum Move { cMove_Up, cMove_Down, cMove_Left, cMove_Right };
@@ -241,9 +401,58 @@ protected:
     
 private:
     
+    // Engines behind RunUntilMoved(): RunBlocks() executes decoded blocks and returns
+    // false if it had to stop short of the stall limit, RunInstructions() then
+    // single-steps from memory; FinishRun() applies the shared end-of-run checks
+    bool RunBlocks( Error& errorOut, int& stepCount, bool& movedOut );
+    bool RunInstructions( Error& errorOut, int& stepCount );
+    bool FinishRun( Error errorCode, bool moved, int executedCount, Error& errorOut, int& stepCount );
+    
+    // Move history for RunUntilDeath(): the state after every move since the last pellet
+    // was eaten (or since the write log filled up). Returns the number of moves back to
+    // an earlier state equal to the current one, or 0 after recording it as new
+    void ResetMoveHistory();
+    int FindRepeatedMove();
+    
+    // Every write to gene memory goes through here so decoded code stays coherent;
+    // returns true if the write changed code that had been decoded
+    bool WriteMemory( int32_t address, int32_t value );
+    
+    // Game recording: notes the words from the given address on as read, if recording
+    void RecordReads( int32_t address, int32_t wordCount );
+    void TakeSnapshot();
+    Error RunRecorded( GameRecord& record );
+    
+    const BoardPosition& GetSnakeHead() const { return m_snakeBody[ m_snakeHead ]; }
+    
+    // Allocates everything; a gene still has to be loaded through Reset()
+    BoardSimulation( int worldSize );
+    
+    // Back to the starting state for whatever memory holds now
+    void ResetState();
+    
     // Memory maps
     int32_t* m_memory;
-    BoardObject* m_boardObjects;
+    CodeCache* m_codeCache;
+    
+    // What memory was loaded from, for Restart(): a gene of a pool, or the given words
+    const GenePool* m_loadedPool;
+    int m_loadedGeneIndex;
+    const int32_t* m_loadedGene;
+    int m_loadedGeneLength;
+    
+    // Hash of the pool chunk each part of memory was loaded with (pages written since
+    // excepted), 0 if it was not loaded from a pool
+    std::vector< uint64_t > m_loadedChunkHashes;
+    
+    // One bit per cDirtyPageWords words of memory, set once a write changed that page
+    static const int cDirtyPageWords = 1024;
+    uint64_t m_dirtyPages[ cMemorySize / cDirtyPageWords / 64 ];
+    
+    // Board as two bitboards, one bit per cell (y * size + x)
+    uint64_t* m_snakeCells;
+    uint64_t* m_pelletCells;
+    
     int32_t m_instructionPtr;
     
     int m_boardSize;
@@ -252,9 +461,19 @@ private:
     // Did system halt, e.g. error?
     Error m_errorCode;
     
-    // Active entities
-    std::vector< BoardPosition > m_snake;
+    // Active entities; the snake is a ring buffer with room for every cell, and
+    // each cell knows the index of its pellet in m_pellets (-1 for none)
+    BoardPosition* m_snakeBody;
+    int m_snakeHead;
+    int m_snakeLength;
     std::vector< BoardPosition > m_pellets;
+    int32_t* m_pelletIndices;
+    
+    // Every empty cell (y * size + x) in no particular order, and each cell's
+    // position in that list (-1 if it is not empty)
+    int32_t* m_freeCells;
+    int32_t* m_freeCellIndices;
+    int m_freeCellCount;
     
     // Fitness measurements
     int m_instructionCount;
@@ -263,6 +482,49 @@ private:
     
     // How many times the snake has moved since last eating
     int m_hungerCount;
+    
+    // Bumped by every write that changed memory; equal epochs mean memory is unchanged
+    uint32_t m_writeEpoch;
+    
+    // While logging, every write that changed memory adds its address and old value,
+    // up to cMaxWriteLogLength of them
+    struct WriteLogEntry
+    {
+        int32_t m_address;
+        int32_t m_value;
+    };
+    static const int cMaxWriteLogLength = 4096;
+    bool m_isLoggingWrites;
+    bool m_isWriteLogFull;
+    std::vector< WriteLogEntry > m_writeLog;
+    
+    // One record per move of the history; the snake's cells are not stored, since without
+    // eating they are just the last heads, which follow the snake as it was at the start
+    struct MoveRecord
+    {
+        int32_t m_instructionPtr;
+        int m_registerA, m_registerB;
+        int m_instructionCount;
+        int m_writeLogLength;
+    };
+    std::vector< MoveRecord > m_moveRecords;
+    std::vector< BoardPosition > m_headHistory;
+    int m_historyPelletCount;
+    
+    // Open-addressing lookup from a record's registers and head to its index + 1; a
+    // history never outgrows cMaxHunger moves, so it stays at most half full
+    static const int cMoveLookupSize = 1024;
+    int32_t m_moveLookup[ cMoveLookupSize ];
+    
+    // Pellet placement
+    RandomStream m_random;
+    
+    // Game being recorded, NULL if none, and one bit per memory word it read so far
+    // (allocated on first use); writes beyond cMaxRecordedWriteCount are not kept
+    static const int cFirstSnapshotInstructionCount = 1024;
+    static const int cMaxRecordedWriteCount = 16384;
+    GameRecord* m_record;
+    uint64_t* m_readWords;
 };
 
 /*** Simulation Controller ***/
@@ -272,13 +534,77 @@ class SimSnake
 {
 public:
     
-    SimSnake( int boardSize, int genePoolCount );
+    // Every random choice (pellets, breeding, padding) derives from the seed, so a run
+    // is reproducible regardless of worker count
+    SimSnake( int boardSize, int genePoolCount, uint64_t randomSeed = 0 );
     ~SimSnake();
     
     // Give the entire simulation one step, which means the current
     // gene will move ahead or die; you can get the current board state
     void Update();
     
+    // Evaluates every gene of the current generation across the worker pool,
+    // then breeds; equivalent to calling Update() until the generation wraps,
+    // but without any per-move stepping (so nothing to draw in-between)
+    void UpdateGeneration();
+    
+    // Steady-state alternative to UpdateGeneration(): there is no generation boundary to
+    // wait at. Worker threads keep breeding a child from the winners of two tournaments,
+    // putting it in place of the loser of a third, and playing its games while the others
+    // go on; they carry on between calls, up to a generation ahead. A call waits until as
+    // many children as a generation would breed have been measured, then holds the workers
+    // only for the stats and migration; snapshots go a gene at a time (see SaveGenePool()),
+    // and breeding only holds them for the commit. Every gene plays all of its trials (no
+    // racing), locally (no farm). Children join as soon as they are measured, so only runs
+    // with a single worker, which never runs ahead, replay the same from a seed. Update()
+    // and UpdateGeneration() stop the workers first
+    void UpdateSteadyState();
+    
+    // Number of threads UpdateGeneration() and UpdateSteadyState() spread genes across (see
+    // WorkScheduler.h); defaults to 1
+    void SetWorkerCount( int workerCount ) { m_workerCount = std::max( 1, workerCount ); }
+    int GetWorkerCount() const { return m_workerCount; }
+    
+    // Games UpdateGeneration() plays per gene, each with its own pellet stream; fitness
+    // is their mean. Genes are raced by successive halving: everyone plays one game,
+    // then only the better half plays twice as many, and so on, but the field never
+    // shrinks below the half of the pool that gets to breed. Defaults to 1
+    void SetTrialCount( int trialCount ) { m_trialCount = std::max( 1, trialCount ); }
+    int GetTrialCount() const { return m_trialCount; }
+    
+    // The gene pool lives in memory; it is loaded from the cGenePoolFileName ("GenePool")
+    // snapshot on construction and only written back by snapshots. Snapshots are taken
+    // every n generations (0 disables), or explicitly through SaveGenePool(), which is
+    // safe while steady-state workers are running
+    void SetSnapshotInterval( int generationCount ) { m_snapshotInterval = generationCount; }
+    bool SaveGenePool() const;
+    
+    // Island mode (see IslandExchange.h): every n generations, right after breeding, the
+    // best genes go out to the next island and the last children are replaced by the
+    // previous island's best, if it sent any new ones. NULL (the default) or 0 disables
+    void SetIsland( IslandExchange* islandExchange, int islandIndex, int migrationInterval );
+    
+    // UpdateGeneration() hands games to the farm's worker processes first (see
+    // EvaluationFarm.h), and plays only what they could not; NULL (the default) disables
+    void SetEvaluationFarm( EvaluationFarm* evaluationFarm ) { m_evaluationFarm = evaluationFarm; }
+    
+    // Incremental evaluation: every gene plays the same games (each trial its own pellet
+    // stream, whatever the gene), so a child plays what its parent played until it first
+    // reads a word it does not share with it. Games are recorded (see GameRecord), and a
+    // child's game either takes its parent's result outright, if it never gets to read such
+    // a word, or resumes from the parent's last snapshot before it does. Results are the
+    // same as playing from the start; what changes is that genes are no longer measured on
+    // games of their own. Not used for games the farm plays; off by default
+    void SetIncrementalEvaluation( bool isEnabled ) { m_isIncrementalEvaluation = isEnabled; }
+    bool GetIncrementalEvaluation() const { return m_isIncrementalEvaluation; }
+    
+    // Games incremental evaluation did not play at all, and games it resumed midway
+    void GetIncrementalStats( int& reusedCount, int& resumedCount ) const;
+    
+    // Stream for one of the games of the gene with the given hash (0 for the games every
+    // gene plays); the same in every process
+    static RandomStream GetGameRandom( uint64_t randomSeed, uint64_t geneHash, int trialIndex );
+    
     const BoardSimulation& GetActiveBoard() const { return *m_activeBoard; }
     
     // Stats getters
@@ -288,18 +614,29 @@ public:
     // Get board stats, useful for high-level progress testing
     void GetStats( int& longestLivedMovementCount, int& mostPelletsEatenCount ) const;
     
+    // UpdateGeneration() only simulates genes it has not measured yet; a hit is a gene
+    // whose result was known in full (kept from the last generation with every game played,
+    // or a duplicate)
+    void GetFitnessCacheStats( int& hitCount, int& missCount ) const;
+    
+    // Percent of the workers' time spent simulating and breeding rather than waiting for
+    // each other (see WorkScheduler::GetUtilization())
+    int GetWorkerUtilization() const;
+    
+    // Genes rank by the racing round they reached first (see SetTrialCount()), then by fitness
     struct GeneFitnessPair
     {
-        GeneFitnessPair( int geneIndex, int fitnessValue )
-        : m_geneIndex( geneIndex ), m_fitnessValue( fitnessValue )
+        GeneFitnessPair( int geneIndex, int fitnessValue, int roundCount = 0 )
+        : m_geneIndex( geneIndex ), m_fitnessValue( fitnessValue ), m_roundCount( roundCount )
         { }
         
         GeneFitnessPair( const GeneFitnessPair& given )
-        : m_geneIndex( given.m_geneIndex ), m_fitnessValue( given.m_fitnessValue )
+        : m_geneIndex( given.m_geneIndex ), m_fitnessValue( given.m_fitnessValue ), m_roundCount( given.m_roundCount )
         { }
         
         int m_geneIndex;
         int m_fitnessValue;
+        int m_roundCount;
     };
     
 protected:
@@ -307,8 +644,22 @@ protected:
     // Core tweak / editable feature of this simulation
     void FitAndBreed();
     
-    // Takes gene A, mixes with gene B, saved to gene replacement index
-    void Breed( int geneIndexA, int geneIndexB, int geneReplacementIndex );
+    // Takes gene A, mixes with gene B, drafted for the gene replacement index; leaves the pool
+    // alone, so any number of children can be bred at once
+    void Breed( int geneIndexA, int geneIndexB, int geneReplacementIndex, GeneDraft& child ) const;
+    void Breed( int geneIndexA, int geneIndexB, RandomStream& random, GeneDraft& child ) const;
+    
+    // Migration and periodic snapshots, due once a generation; the given genes are the whole
+    // pool, best first, the first ones going out and the last ones making room for newcomers.
+    // MigrateGenes() is just the migration, and IsSnapshotDue() whether a snapshot is; both
+    // expect the generation count to be bumped afterwards
+    void EndGeneration( const std::vector< int >& rankedGeneIndices );
+    void MigrateGenes( const std::vector< int >& rankedGeneIndices );
+    bool IsSnapshotDue() const { return m_snapshotInterval > 0 && ( m_generationCount + 1 ) % m_snapshotInterval == 0; }
+    
+    // Stream for one of the games of a gene; keyed by content, so equal genes play the same
+    // games, unless every gene does (see SetIncrementalEvaluation())
+    RandomStream GetGameRandom( int geneIndex, int trialIndex = 0 ) const;
     
 private:
     
@@ -316,6 +667,25 @@ private:
     int m_boardSize;
     BoardSimulation* m_activeBoard;
     
+    // Simulations kept across calls, one per worker of UpdateGeneration()'s EvaluateTrials();
+    // steady-state workers (RunSteadyWorker()) use the same ones. NULL until first used
+    std::vector< BoardSimulation* > m_workerBoards;
+    
+    // Every gene of the population, ordered by index
+    GenePool* m_genePool;
+    int m_snapshotInterval;
+    
+    // Children in the making, kept from one generation to the next
+    std::vector< GeneDraft* > m_childDrafts;
+    
+    // Island mode; not owned
+    IslandExchange* m_islandExchange;
+    int m_islandIndex;
+    int m_migrationInterval;
+    
+    // Remote evaluation; not owned
+    EvaluationFarm* m_evaluationFarm;
+    
     // List of gene ranks (lower value is better); stored in index order, defaults to int_max if not yet measured
     std::vector< GeneFitnessPair > m_geneFitness;
     
@@ -324,11 +694,100 @@ private:
     int m_stepCount;
     int m_generationCount;
     int m_genePoolSize;
+    uint64_t m_randomSeed;
+    
+    // Threads used by UpdateGeneration(); started on first use, and again if the count changed
+    int m_workerCount;
+    WorkScheduler* m_workScheduler;
+    WorkScheduler& GetWorkScheduler();
+    int m_trialCount;
+    bool m_isIncrementalEvaluation;
     
     // Tracking
     int m_maxMovementCount;
     int m_maxPelletEattenCount;
     
+    // Outcome of a gene's games so far: the first game's cause of death, the sum of
+    // fitness over all games, the best movement and pellet counts, and each game's fitness
+    // in trial order
+    struct GeneResult
+    {
+        Error m_error;
+        int64_t m_fitnessSum;
+        int m_trialCount;
+        int m_movementCount;
+        int m_pelletCount;
+        std::vector< int64_t > m_trialFitness;
+        
+        int GetFitness() const { return int( m_fitnessSum / std::max( 1, m_trialCount ) ); }
+        
+        // Mean over no more than the first trialCount games, so a result kept with more of
+        // them ranks on the same games as those that only played that many
+        int GetFitness( int trialCount ) const
+        {
+            if( trialCount >= m_trialCount || trialCount > int( m_trialFitness.size() ) )
+            {
+                return GetFitness();
+            }
+            
+            int64_t fitnessSum = 0;
+            for( int i = 0; i < trialCount; i++ )
+            {
+                fitnessSum += m_trialFitness[ i ];
+            }
+            return int( fitnessSum / std::max( 1, trialCount ) );
+        }
+    };
+    
+    // Plays games of the given (distinct) genes until each has played trialCount of them
+    void EvaluateTrials( const std::vector< int >& geneIndices, int trialCount, std::vector< GeneResult >& geneResults );
+    
+    // Results of the last evaluated generation, by gene hash; valid as long as the seed
+    // is the same, since games only depend on the gene and the seed
+    std::unordered_map< uint64_t, GeneResult > m_fitnessCache;
+    int m_fitnessCacheHitCount;
+    int m_fitnessCacheMissCount;
+    
+    // Incremental evaluation: recorded games by gene hash, one per trial (NULL if not
+    // recorded), kept for the genes in the pool; and the gene each child was drafted from
+    std::unordered_map< uint64_t, std::vector< std::shared_ptr< const GameRecord > > > m_gameRecords;
+    std::unordered_map< uint64_t, uint64_t > m_parentHashes;
+    int m_reusedGameCount;
+    int m_resumedGameCount;
+    
+    // Steady state (see UpdateSteadyState()): threads that keep measuring genes and breeding
+    // children between calls, and what they share. The mutex guards all of it and the pool,
+    // bar the games themselves and reads counted as readers (breeding, writing a child's
+    // words); the pool only changes once there are none, and the genes a worker breeds from
+    // (its two parents, -1 if none) are not replaced until it is done. The counts are folded
+    // into the stats once a generation
+    enum SteadyGeneState
+    {
+        cSteadyGene_Unmeasured,
+        cSteadyGene_Breeding,
+        cSteadyGene_Playing,
+        cSteadyGene_Measured,
+    };
+    void StartSteadyState( int workerCount );
+    void StopSteadyState();
+    void RunSteadyWorker( int workerIndex );
+    std::vector< std::thread > m_steadyThreads;
+    mutable std::mutex m_steadyMutex;
+    mutable std::condition_variable m_steadyCondition;
+    std::vector< SteadyGeneState > m_steadyGeneStates;
+    std::vector< int > m_steadyWorkerGenes;
+    std::vector< int > m_steadyWorkerParents;
+    int m_steadyReaderCount;
+    int m_steadyChildTarget;
+    int m_steadyChildLimit;
+    int m_steadyStartedCount;
+    int m_steadyMeasuredCount;
+    int m_steadyHitCount;
+    int m_steadyMissCount;
+    int m_steadyMovementCount;
+    int m_steadyPelletCount;
+    bool m_isSteadyQuitting;
+    
 };
 
 #endif
@@ -0,0 +1,198 @@
+//
+//  WorkScheduler.cpp
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+
+#include "WorkScheduler.h"
+
+#include <algorithm>
+
+WorkScheduler::WorkScheduler( int workerCount )
+    : m_workerCount( std::max( 1, workerCount ) )
+    , m_ranges( m_workerCount )
+    , m_stolenCount( 0 )
+    , m_busyTime( 0 )
+    , m_runTime( 0 )
+    , m_task( NULL )
+    , m_runWorkerCount( 0 )
+    , m_runIndex( 0 )
+    , m_busyWorkerCount( 0 )
+    , m_isQuitting( false )
+{
+    for( int i = 0; i < m_workerCount; i++ )
+    {
+        m_ranges[ i ].m_range.store( 0 );
+    }
+    for( int i = 1; i < m_workerCount; i++ )
+    {
+        m_threads.push_back( std::thread( &WorkScheduler::WorkerThread, this, i ) );
+    }
+}
+
+WorkScheduler::~WorkScheduler()
+{
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_isQuitting = true;
+    }
+    m_runStarted.notify_all();
+    
+    for( size_t i = 0; i < m_threads.size(); i++ )
+    {
+        m_threads[ i ].join();
+    }
+}
+
+void WorkScheduler::Run( int taskCount, const Task& task, int maxWorkerCount )
+{
+    if( taskCount <= 0 )
+    {
+        return;
+    }
+    
+    // Even shares in index order, so neighboring tasks mostly stay on one worker; workers
+    // not taking part get an empty range
+    const int workerCount = std::max( 1, std::min( std::min( maxWorkerCount, m_workerCount ), taskCount ) );
+    for( int i = 0; i < m_workerCount; i++ )
+    {
+        const uint32_t firstIndex = uint32_t( int64_t( taskCount ) * std::min( i, workerCount ) / workerCount );
+        const uint32_t endIndex = uint32_t( int64_t( taskCount ) * std::min( i + 1, workerCount ) / workerCount );
+        m_ranges[ i ].m_range.store( PackRange( firstIndex, endIndex ) );
+    }
+    
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_task = &task;
+        m_runWorkerCount = workerCount;
+        m_busyWorkerCount = workerCount - 1;
+        m_runIndex++;
+    }
+    if( workerCount > 1 )
+    {
+        m_runStarted.notify_all();
+    }
+    
+    RunTasks( 0 );
+    
+    std::unique_lock< std::mutex > lock( m_mutex );
+    m_runFinished.wait( lock, [&]() { return m_busyWorkerCount == 0; } );
+    m_task = NULL;
+    
+    m_runTime += workerCount * std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - startTime ).count();
+}
+
+int WorkScheduler::GetUtilization() const
+{
+    return ( m_runTime > 0 ) ? int( m_busyTime * 100 / m_runTime ) : 100;
+}
+
+void WorkScheduler::RunTasks( int workerIndex )
+{
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    while( true )
+    {
+        int taskIndex = 0;
+        if( TakeTask( workerIndex, taskIndex ) )
+        {
+            ( *m_task )( taskIndex, workerIndex );
+        }
+        else if( !StealTasks( workerIndex ) )
+        {
+            break;
+        }
+    }
+    m_busyTime += std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - startTime ).count();
+}
+
+bool WorkScheduler::TakeTask( int workerIndex, int& taskIndex )
+{
+    std::atomic< uint64_t >& range = m_ranges[ workerIndex ].m_range;
+    uint64_t current = range.load();
+    while( true )
+    {
+        const uint32_t firstIndex = uint32_t( current );
+        const uint32_t endIndex = uint32_t( current >> 32 );
+        if( firstIndex >= endIndex )
+        {
+            return false;
+        }
+        
+        if( range.compare_exchange_weak( current, PackRange( firstIndex + 1, endIndex ) ) )
+        {
+            taskIndex = int( firstIndex );
+            return true;
+        }
+    }
+}
+
+bool WorkScheduler::StealTasks( int workerIndex )
+{
+    // Only ever called on an empty range, which nobody else changes, so the stolen half can
+    // simply be stored there. A last task is taken whole, since its owner may be busy for long
+    while( true )
+    {
+        int victimIndex = -1;
+        uint64_t victimRange = 0;
+        uint32_t mostTaskCount = 0;
+        for( int i = 0; i < m_runWorkerCount; i++ )
+        {
+            const uint64_t current = m_ranges[ i ].m_range.load();
+            const uint32_t firstIndex = uint32_t( current );
+            const uint32_t endIndex = uint32_t( current >> 32 );
+            if( i != workerIndex && endIndex > firstIndex && endIndex - firstIndex > mostTaskCount )
+            {
+                victimIndex = i;
+                victimRange = current;
+                mostTaskCount = endIndex - firstIndex;
+            }
+        }
+        
+        if( victimIndex < 0 )
+        {
+            return false;
+        }
+        
+        const uint32_t firstIndex = uint32_t( victimRange );
+        const uint32_t endIndex = uint32_t( victimRange >> 32 );
+        const uint32_t middleIndex = firstIndex + ( endIndex - firstIndex ) / 2;
+        if( m_ranges[ victimIndex ].m_range.compare_exchange_strong( victimRange, PackRange( firstIndex, middleIndex ) ) )
+        {
+            m_ranges[ workerIndex ].m_range.store( PackRange( middleIndex, endIndex ) );
+            m_stolenCount += int( endIndex - middleIndex );
+            return true;
+        }
+    }
+}
+
+void WorkScheduler::WorkerThread( int workerIndex )
+{
+    uint64_t runIndex = 0;
+    std::unique_lock< std::mutex > lock( m_mutex );
+    while( true )
+    {
+        m_runStarted.wait( lock, [&]() { return m_isQuitting || m_runIndex != runIndex; } );
+        if( m_isQuitting )
+        {
+            return;
+        }
+        
+        // Runs this worker sits out are skipped; one it takes part in cannot finish without it
+        runIndex = m_runIndex;
+        if( workerIndex >= m_runWorkerCount )
+        {
+            continue;
+        }
+        
+        lock.unlock();
+        RunTasks( workerIndex );
+        lock.lock();
+        
+        if( --m_busyWorkerCount == 0 )
+        {
+            m_runFinished.notify_one();
+        }
+    }
+}
@@ -0,0 +1,93 @@
+//
+//  WorkScheduler.h
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+// Runs loops of independent tasks on worker threads that stay around from one
+// loop to the next. Every worker starts out with an even share of the task
+// indices, as one range it works through from the front; a worker that runs
+// dry steals the back half of whichever range has the most left. A gene that
+// plays for hundreds of thousands of instructions then only holds up the
+// tasks queued behind it until somebody else is free to take them.
+//
+// A range is its first and last index packed into one word, so the owner
+// taking a task and a thief splitting the range are each a single exchange.
+
+#ifndef __WORKSCHEDULER_H__
+#define __WORKSCHEDULER_H__
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+class WorkScheduler
+{
+public:
+    
+    // Starts workerCount - 1 threads; whoever calls Run() is worker 0
+    explicit WorkScheduler( int workerCount );
+    ~WorkScheduler();
+    
+    int GetWorkerCount() const { return m_workerCount; }
+    
+    // Calls task( taskIndex, workerIndex ) once for every index below taskCount, spread over at
+    // most maxWorkerCount workers, and returns once every call has; tasks must not call Run()
+    typedef std::function< void( int, int ) > Task;
+    void Run( int taskCount, const Task& task, int maxWorkerCount );
+    
+    // Tasks that ran on another worker than the one they were handed to, over all runs
+    int GetStolenCount() const { return m_stolenCount; }
+    
+    // Share of the time workers were taking part in runs that they spent on tasks rather
+    // than waiting for the others to finish, in percent; how close a run comes to scaling
+    // with the worker count when every worker has a core of its own
+    int GetUtilization() const;
+    
+private:
+    
+    // Ranges sit a cache line apart, since their owners change them with every task
+    struct TaskRange
+    {
+        std::atomic< uint64_t > m_range;
+        char m_padding[ 64 - sizeof( std::atomic< uint64_t > ) ];
+    };
+    
+    static uint64_t PackRange( uint32_t firstIndex, uint32_t endIndex ) { return ( uint64_t( endIndex ) << 32 ) | firstIndex; }
+    
+    // Takes tasks from the worker's own range, stealing more whenever it runs dry, until
+    // there are none left anywhere
+    void RunTasks( int workerIndex );
+    bool TakeTask( int workerIndex, int& taskIndex );
+    bool StealTasks( int workerIndex );
+    
+    void WorkerThread( int workerIndex );
+    
+    int m_workerCount;
+    std::vector< TaskRange > m_ranges;
+    std::vector< std::thread > m_threads;
+    std::atomic< int > m_stolenCount;
+    
+    // Nanoseconds spent in RunTasks() by all workers, and the run time times the workers
+    // taking part
+    std::atomic< int64_t > m_busyTime;
+    int64_t m_runTime;
+    
+    // The run in progress; threads wait for the run index to change, and the caller
+    // for every other worker taking part to finish
+    std::mutex m_mutex;
+    std::condition_variable m_runStarted;
+    std::condition_variable m_runFinished;
+    const Task* m_task;
+    int m_runWorkerCount;
+    uint64_t m_runIndex;
+    int m_busyWorkerCount;
+    bool m_isQuitting;
+};
+
+#endif
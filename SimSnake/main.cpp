@@ -7,9 +7,19 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <signal.h>
+
+#if defined( __linux__ )
+    #include <sys/prctl.h>
+#endif
 
 #include "SimSnake.h"
+#include "GenePool.h"
+#include "IslandExchange.h"
+#include "EvaluationFarm.h"
 
 //#define __ConsoleBuild__
 #ifdef __ConsoleBuild__
@@ -27,7 +37,7 @@ bool DoesFileExist( const char* fileName )
     return doesExist;
 }
 
-// Converts all hand-crafted scripts to Gene0, Gene1, etc..
+// Seeds the population file from all hand-crafted scripts, but only if it does not yet exist
 void ExportGenes( int genePoolCount )
 {
     // List of "seeding" programs (in assembly-like syntax)
@@ -40,31 +50,30 @@ void ExportGenes( int genePoolCount )
         "EdgeWalk.txt",
     };
     
+    // Only write out if the file does not yet exist
+    if( DoesFileExist( cGenePoolFileName ) )
+    {
+        return;
+    }
+    
+    GenePool genePool( genePoolCount );
     for( int i = 0; i < genePoolCount; i++ )
     {
         const char* scriptFileName = cFileNames[ i % cFileCount ];
-        char outFileName[ 512 ];
-        sprintf( outFileName, "Gene%d", i );
-        
-        // Only write out if the file does not yet exist
-        if( DoesFileExist( outFileName ) )
-        {
-            continue;
-        }
         
         Gene gene;
         if( !LoadTxtGene( scriptFileName, gene ) )
         {
             printf( "Unable to load script \"%s\"!\n", scriptFileName );
-            continue;
         }
         
-        if( !WriteGene( outFileName, gene ) )
-        {
-            printf( "Unable to serialize script \"%s\"!\n", outFileName );
-        }
+        genePool.SetGene( i, gene );
     }
     
+    if( !genePool.SaveSnapshot() )
+    {
+        printf( "Unable to serialize the gene pool \"%s\"!\n", cGenePoolFileName );
+    }
 }
 
 // Main application entry point
@@ -73,11 +82,119 @@ int main(int argc, const char * argv[])
     const int cBoardSize = 32;
     const int cGenePoolCount = 64;
     
+    // "worker <address>" plays games for a coordinator (see below) instead
+    if( argc > 2 && strcmp( argv[ 1 ], "worker" ) == 0 )
+    {
+        return EvaluationFarm::RunWorker( argv[ 2 ] ) ? 0 : 1;
+    }
+    
+    // Optional first argument: number of worker threads; more than one (or any of the
+    // modes below) evaluates whole generations instead of printing every move
+    const int workerCount = ( argc > 1 ) ? atoi( argv[ 1 ] ) : 1;
+    
+    // Optional second argument: "incremental" plays every gene on the same games so children
+    // can pick up their parents' games, "steady" breeds children one at a time as workers
+    // free up instead of generation by generation
+    const bool isIncrementalEvaluation = ( argc > 2 ) && strcmp( argv[ 2 ], "incremental" ) == 0;
+    const bool isSteadyState = ( argc > 2 ) && strcmp( argv[ 2 ], "steady" ) == 0;
+    
+    // Optional third argument: random seed; the same seed replays the same run
+    const uint64_t randomSeed = ( argc > 3 ) ? strtoull( argv[ 3 ], NULL, 10 ) : 0;
+    
+    // Optional fourth argument: games per gene, raced down to the breeding half
+    const int trialCount = ( argc > 4 ) ? atoi( argv[ 4 ] ) : 1;
+    
+    // Optional fifth and sixth arguments: number of island processes, and how many
+    // generations they evolve between migrations (10 by default)
+    const int islandCount = ( argc > 5 ) ? std::max( 1, atoi( argv[ 5 ] ) ) : 1;
+    const int migrationInterval = ( argc > 6 ) ? atoi( argv[ 6 ] ) : 10;
+    
+    // Optional seventh argument: socket path or "host:port" to take worker processes on
+    const char* farmAddress = ( argc > 7 ) ? argv[ 7 ] : NULL;
+    
     // Seed the world, but only if the files do not yet exist
     ExportGenes( cGenePoolCount );
     
-    // Begin a simple simulation
-    SimSnake simSnake( cBoardSize, cGenePoolCount );
+    // Every island is its own process, all starting from the same population; the
+    // exchange has to exist before forking so they all share it
+    IslandExchange islandExchange( islandCount );
+    int islandIndex = 0;
+    for( int i = 1; i < islandCount && islandIndex == 0; i++ )
+    {
+        if( fork() == 0 )
+        {
+            islandIndex = i;
+            
+            // Islands go down with the first one
+            #if defined( __linux__ )
+                prctl( PR_SET_PDEATHSIG, SIGTERM );
+            #endif
+        }
+    }
+    
+    // Begin a simple simulation; islands differ by seed
+    SimSnake simSnake( cBoardSize, cGenePoolCount, randomSeed + islandIndex );
+    simSnake.SetWorkerCount( workerCount );
+    simSnake.SetIncrementalEvaluation( isIncrementalEvaluation );
+    simSnake.SetTrialCount( trialCount );
+    
+    if( islandCount > 1 )
+    {
+        // Only the first island snapshots, so they do not overwrite each other
+        simSnake.SetIsland( &islandExchange, islandIndex, migrationInterval );
+        if( islandIndex > 0 )
+        {
+            simSnake.SetSnapshotInterval( 0 );
+        }
+    }
+    
+    // Only the first island runs a farm, since only one can listen on the address
+    EvaluationFarm evaluationFarm;
+    if( farmAddress != NULL && islandIndex == 0 && evaluationFarm.Listen( farmAddress ) )
+    {
+        simSnake.SetEvaluationFarm( &evaluationFarm );
+    }
+    
+    // Every move is only printed for a plain run; any mode asked for above goes a generation
+    // at a time, whatever the worker count
+    const bool isPrintingMoves = workerCount <= 1 && !isIncrementalEvaluation && !isSteadyState && islandCount == 1 && farmAddress == NULL;
+    while( !isPrintingMoves )
+    {
+        if( isSteadyState )
+        {
+            simSnake.UpdateSteadyState();
+        }
+        else
+        {
+            simSnake.UpdateGeneration();
+        }
+        
+        int mostMoveCount, mostPelletsCount;
+        simSnake.GetStats( mostMoveCount, mostPelletsCount );
+        
+        int cacheHitCount, cacheMissCount;
+        simSnake.GetFitnessCacheStats( cacheHitCount, cacheMissCount );
+        
+        if( islandCount > 1 )
+        {
+            printf( "Island %d, ", islandIndex );
+        }
+        printf( "Generation Count #%d\n", simSnake.GetGenerationCount() );
+        printf( "Most snake moves: %d, most pellets eaten: %d\n", mostMoveCount, mostPelletsCount );
+        printf( "Genes simulated: %d, results reused: %d\n", cacheMissCount, cacheHitCount );
+        
+        if( workerCount > 1 )
+        {
+            printf( "Worker utilization: %d%%\n", simSnake.GetWorkerUtilization() );
+        }
+        
+        if( isIncrementalEvaluation )
+        {
+            int reusedGameCount, resumedGameCount;
+            simSnake.GetIncrementalStats( reusedGameCount, resumedGameCount );
+            printf( "Games taken from parents: %d, resumed from parents: %d\n", reusedGameCount, resumedGameCount );
+        }
+    }
     
     while( true )
     {
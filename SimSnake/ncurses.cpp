@@ -10,6 +10,7 @@
 #include <unistd.h>
 
 #include "SimSnake.h"
+#include "GenePool.h"
 
 #include <curses.h>
 
@@ -94,7 +95,7 @@ bool DoesFileExist( const char* fileName )
     return doesExist;
 }
 
-// Converts all hand-crafted scripts to Gene0, Gene1, etc..
+// Seeds the population file from all hand-crafted scripts, but only if it does not yet exist
 void ExportGenes( int genePoolCount )
 {
     // List of "seeding" programs (in assembly-like syntax)
@@ -107,31 +108,30 @@ void ExportGenes( int genePoolCount )
         "EdgeWalk.txt",
     };
     
+    // Only write out if the file does not yet exist
+    if( DoesFileExist( cGenePoolFileName ) )
+    {
+        return;
+    }
+    
+    GenePool genePool( genePoolCount );
     for( int i = 0; i < genePoolCount; i++ )
     {
         const char* scriptFileName = cFileNames[ i % cFileCount ];
-        char outFileName[ 512 ];
-        sprintf( outFileName, "Gene%d", i );
-        
-        // Only write out if the file does not yet exist
-        if( DoesFileExist( outFileName ) )
-        {
-            continue;
-        }
         
         Gene gene;
         if( !LoadTxtGene( scriptFileName, gene ) )
         {
             printf( "Unable to load script \"%s\"!\n", scriptFileName );
-            continue;
         }
         
-        if( !WriteGene( outFileName, gene ) )
-        {
-            printf( "Unable to serialize script \"%s\"!\n", outFileName );
-        }
+        genePool.SetGene( i, gene );
     }
     
+    if( !genePool.SaveSnapshot() )
+    {
+        printf( "Unable to serialize the gene pool \"%s\"!\n", cGenePoolFileName );
+    }
 }
 
 // Main application entry point
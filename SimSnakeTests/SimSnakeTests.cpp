@@ -0,0 +1,340 @@
+//
+//  SimSnakeTests.cpp
+//  SimSnake
+//
+//  Copyright (c) 2014 CoreS2. All rights reserved.
+//
+// Checks that every way of playing a game ends it the same way, and that a seed
+// replays the same run whatever the worker count. Takes the directory holding the
+// seed scripts as its only argument; the SimSnakeTests target runs it after every
+// build, and fails the build if anything differs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <climits>
+#include <string>
+#include <vector>
+
+#include "SimSnake.h"
+#include "GenePool.h"
+#include "NativeCode.h"
+
+namespace
+{
+    const uint64_t cRandomSeed = 7;
+    const int cGenePoolCount = 32;
+    const int cTrialCount = 2;
+    const int cGenerationCount = 5;
+    
+    const int cScriptCount = 4;
+    const char* cScriptNames[ cScriptCount ] =
+    {
+        "ScanFillSnake.txt",
+        "GoRight.txt",
+        "LeftRightCycle.txt",
+        "EdgeWalk.txt",
+    };
+    
+    int s_failureCount = 0;
+    
+    // How a game ended
+    struct GameResult
+    {
+        Error m_error;
+        int m_fitness;
+        int m_instructionCount;
+        int m_movementCount;
+        int m_pelletCount;
+        
+        bool operator==( const GameResult& other ) const
+        {
+            return m_error == other.m_error && m_fitness == other.m_fitness && m_instructionCount == other.m_instructionCount && m_movementCount == other.m_movementCount && m_pelletCount == other.m_pelletCount;
+        }
+    };
+    
+    GameResult GetResult( const BoardSimulation& board, Error error )
+    {
+        GameResult result = { error, board.GetFitness(), board.GetInstructionCount(), board.GetMovementCount(), board.GetPelletCount() };
+        return result;
+    }
+    
+    void Check( bool isPassing, const char* engineName, int boardSize, int geneIndex, int trialIndex, const GameResult& expected, const GameResult& actual )
+    {
+        if( isPassing )
+        {
+            return;
+        }
+        
+        printf( "FAILED: %s, board %d, gene %d, game %d: \"%s\" fitness %d (%d instructions, %d moves, %d pellets), expected \"%s\" fitness %d (%d instructions, %d moves, %d pellets)\n",
+            engineName, boardSize, geneIndex, trialIndex,
+            ErrorNames[ (int)actual.m_error ], actual.m_fitness, actual.m_instructionCount, actual.m_movementCount, actual.m_pelletCount,
+            ErrorNames[ (int)expected.m_error ], expected.m_fitness, expected.m_instructionCount, expected.m_movementCount, expected.m_pelletCount );
+        s_failureCount++;
+    }
+    
+    // One instruction at a time, with the stall rule of RunUntilMoved()
+    GameResult PlayByInstruction( int boardSize, const GenePool& genePool, int geneIndex, const RandomStream& random )
+    {
+        BoardSimulation board( boardSize, genePool, geneIndex, random );
+        
+        Error error = cError_None;
+        int stepCount = 0;
+        while( error == cError_None )
+        {
+            const bool hasMoved = board.UpdateSimulation( error );
+            if( stepCount > cStallCount )
+            {
+                error = cError_Stalled;
+            }
+            stepCount = hasMoved ? 0 : ( stepCount + 1 );
+        }
+        return GetResult( board, error );
+    }
+    
+    // One move at a time, through decoded blocks (and native code, if enabled)
+    GameResult PlayByMove( int boardSize, const GenePool& genePool, int geneIndex, const RandomStream& random )
+    {
+        BoardSimulation board( boardSize, genePool, geneIndex, random );
+        
+        Error error = cError_None;
+        int stepCount = 0;
+        while( error == cError_None )
+        {
+            board.RunUntilMoved( error, stepCount );
+        }
+        return GetResult( board, error );
+    }
+    
+    GameResult PlayUntilDeath( int boardSize, const GenePool& genePool, int geneIndex, const RandomStream& random )
+    {
+        BoardSimulation board( boardSize, genePool, geneIndex, random );
+        const Error error = board.RunUntilDeath();
+        return GetResult( board, error );
+    }
+    
+    // The seed scripts, then children of them with a few words changed, and a gene that
+    // divides INT_MIN by -1, reads the board far off its edge and then divides by zero
+    void FillGenePool( GenePool& genePool, const std::vector< Gene >& scripts, std::vector< int >& parentIndices )
+    {
+        parentIndices.assign( cGenePoolCount, -1 );
+        for( int i = 0; i < cScriptCount; i++ )
+        {
+            genePool.SetGene( i, scripts[ i ], cRandomSeed );
+        }
+        
+        const int32_t edgeCases[] =
+        {
+            cInstruction_SetA, INT_MIN, cInstruction_SetB, -1, cInstruction_Div,
+            cInstruction_SetA, INT_MIN, cInstruction_SetB, -1, cInstruction_Mod,
+            cInstruction_Board, -100000, INT_MAX, cInstruction_Board, INT_MIN, 0,
+            cInstruction_SetB, 0, cInstruction_Div, cInstruction_Mod,
+            cInstruction_GoRight,
+        };
+        genePool.SetGene( cScriptCount, Gene( edgeCases, edgeCases + sizeof( edgeCases ) / sizeof( edgeCases[ 0 ] ) ), cRandomSeed );
+        
+        RandomStream random( cRandomSeed, cRandomStream_Breed );
+        for( int i = cScriptCount + 1; i < cGenePoolCount; i++ )
+        {
+            const int parentIndex = i % cScriptCount;
+            genePool.CopyGene( parentIndex, i );
+            parentIndices[ i ] = parentIndex;
+            
+            // A few words anywhere in the script or right behind it, or a single one near its
+            // end, which games often get to late enough to resume from a snapshot
+            const int scriptSize = int( scripts[ parentIndex ].size() );
+            const int changeCount = ( i % 2 == 0 ) ? ( 1 + random.NextInt( 3 ) ) : 1;
+            for( int j = 0; j < changeCount; j++ )
+            {
+                const int32_t address = ( i % 2 == 0 ) ? random.NextInt( scriptSize + 16 ) : std::max( 0, scriptSize - 16 ) + random.NextInt( 16 );
+                const int32_t value = ( random.NextInt( 2 ) == 0 ) ? random.NextInt( cInstructionCount ) : random.NextInt( 64 ) - 32;
+                genePool.SetWord( i, address, value );
+            }
+        }
+    }
+    
+    // Every engine against single-stepping, on every gene and game; children are also
+    // resumed from their parent's game, the way incremental evaluation does
+    void CheckEngines( int boardSize, const GenePool& genePool, const std::vector< int >& parentIndices )
+    {
+        for( int geneIndex = 0; geneIndex < cGenePoolCount; geneIndex++ )
+        {
+            for( int trialIndex = 0; trialIndex < cTrialCount; trialIndex++ )
+            {
+                const RandomStream random = SimSnake::GetGameRandom( cRandomSeed, 0, trialIndex );
+                const GameResult expected = PlayByInstruction( boardSize, genePool, geneIndex, random );
+                
+                NativeCodeArena::SetEnabled( false );
+                const GameResult blockResult = PlayByMove( boardSize, genePool, geneIndex, random );
+                Check( blockResult == expected, "RunBlocks", boardSize, geneIndex, trialIndex, expected, blockResult );
+                
+                NativeCodeArena::SetEnabled( true );
+                const GameResult nativeResult = PlayByMove( boardSize, genePool, geneIndex, random );
+                Check( nativeResult == expected, "RunBlocks with native code", boardSize, geneIndex, trialIndex, expected, nativeResult );
+                
+                const GameResult deathResult = PlayUntilDeath( boardSize, genePool, geneIndex, random );
+                Check( deathResult == expected, "RunUntilDeath", boardSize, geneIndex, trialIndex, expected, deathResult );
+                
+                BoardSimulation board( boardSize, genePool, geneIndex, random );
+                GameRecord record;
+                const GameResult recordResult = GetResult( board, board.RecordUntilDeath( record ) );
+                Check( recordResult == expected, "RecordUntilDeath", boardSize, geneIndex, trialIndex, expected, recordResult );
+                
+                const int parentIndex = parentIndices[ geneIndex ];
+                if( parentIndex < 0 )
+                {
+                    continue;
+                }
+                
+                // From the parent's last snapshot before the child's first change, or the
+                // parent's result as is if the game never reads one
+                GameRecord parentRecord;
+                board.Reset( genePool, parentIndex, random );
+                board.RecordUntilDeath( parentRecord );
+                
+                const int changeSnapshotCount = parentRecord.FindFirstChange( genePool, geneIndex, parentIndex );
+                GameResult resumeResult = { parentRecord.m_error, parentRecord.m_fitness, parentRecord.m_instructionCount, parentRecord.m_movementCount, parentRecord.m_pelletCount };
+                if( changeSnapshotCount >= 0 )
+                {
+                    board.Reset( genePool, geneIndex, random );
+                    GameRecord childRecord;
+                    const Error error = ( changeSnapshotCount > 0 ) ? board.ResumeUntilDeath( parentRecord, changeSnapshotCount - 1, childRecord ) : board.RecordUntilDeath( childRecord );
+                    resumeResult = GetResult( board, error );
+                }
+                Check( resumeResult == expected, "ResumeUntilDeath", boardSize, geneIndex, trialIndex, expected, resumeResult );
+            }
+        }
+    }
+    
+    bool ReadFile( const char* fileName, std::string& contents )
+    {
+        FILE* file = fopen( fileName, "rb" );
+        if( file == NULL )
+        {
+            return false;
+        }
+        
+        contents.clear();
+        char buffer[ 65536 ];
+        size_t readSize = 0;
+        while( ( readSize = fread( buffer, 1, sizeof( buffer ), file ) ) > 0 )
+        {
+            contents.append( buffer, readSize );
+        }
+        fclose( file );
+        return true;
+    }
+    
+    // Runs a few generations from the pool, in the working directory, and returns the pool
+    // they leave behind as written to disk
+    std::string Evolve( const GenePool& genePool, int boardSize, int workerCount, bool isIncrementalEvaluation, bool isSteadyState )
+    {
+        genePool.SaveSnapshot();
+        {
+            SimSnake simSnake( boardSize, cGenePoolCount, cRandomSeed );
+            simSnake.SetWorkerCount( workerCount );
+            simSnake.SetIncrementalEvaluation( isIncrementalEvaluation );
+            simSnake.SetTrialCount( cTrialCount );
+            simSnake.SetSnapshotInterval( 0 );
+            
+            for( int i = 0; i < cGenerationCount; i++ )
+            {
+                if( isSteadyState )
+                {
+                    simSnake.UpdateSteadyState();
+                }
+                else
+                {
+                    simSnake.UpdateGeneration();
+                }
+            }
+            simSnake.SaveGenePool();
+        }
+        
+        std::string contents;
+        ReadFile( cGenePoolFileName, contents );
+        remove( cGenePoolFileName );
+        return contents;
+    }
+    
+    void CheckDeterminism( const GenePool& genePool, int boardSize )
+    {
+        struct Run
+        {
+            const char* m_name;
+            int m_workerCount;
+            bool m_isIncrementalEvaluation;
+            bool m_isSteadyState;
+        };
+        
+        // Steady state only replays with a single worker (see UpdateSteadyState())
+        const Run runs[] =
+        {
+            { "generations", 3, false, false },
+            { "incremental generations", 3, true, false },
+            { "steady state", 1, false, true },
+        };
+        
+        for( size_t i = 0; i < sizeof( runs ) / sizeof( runs[ 0 ] ); i++ )
+        {
+            const Run& run = runs[ i ];
+            const std::string expected = Evolve( genePool, boardSize, 1, run.m_isIncrementalEvaluation, run.m_isSteadyState );
+            const std::string actual = Evolve( genePool, boardSize, run.m_workerCount, run.m_isIncrementalEvaluation, run.m_isSteadyState );
+            if( expected.empty() || actual != expected )
+            {
+                printf( "FAILED: %s, board %d: %d workers did not replay the single-worker run\n", run.m_name, boardSize, run.m_workerCount );
+                s_failureCount++;
+            }
+        }
+    }
+}
+
+int main( int argc, const char* argv[] )
+{
+    if( argc < 2 )
+    {
+        printf( "Usage: %s <script directory>\n", argv[ 0 ] );
+        return 1;
+    }
+    
+    std::vector< Gene > scripts( cScriptCount );
+    for( int i = 0; i < cScriptCount; i++ )
+    {
+        const std::string scriptFileName = std::string( argv[ 1 ] ) + "/" + cScriptNames[ i ];
+        if( !LoadTxtGene( scriptFileName.c_str(), scripts[ i ] ) )
+        {
+            printf( "Unable to load script \"%s\"!\n", scriptFileName.c_str() );
+            return 1;
+        }
+    }
+    
+    GenePool genePool( cGenePoolCount );
+    std::vector< int > parentIndices;
+    FillGenePool( genePool, scripts, parentIndices );
+    
+    // A 1x1 board is full from the start; 5x5 fills up quickly
+    const int boardSizes[] = { 32, 5, 1 };
+    for( size_t i = 0; i < sizeof( boardSizes ) / sizeof( boardSizes[ 0 ] ); i++ )
+    {
+        CheckEngines( boardSizes[ i ], genePool, parentIndices );
+    }
+    
+    // SimSnake reads and writes its pool in the working directory
+    char directoryName[] = "/tmp/SimSnakeTests.XXXXXX";
+    if( mkdtemp( directoryName ) == NULL || chdir( directoryName ) != 0 )
+    {
+        printf( "Unable to create a working directory!\n" );
+        return 1;
+    }
+    CheckDeterminism( genePool, 32 );
+    CheckDeterminism( genePool, 5 );
+    rmdir( directoryName );
+    
+    if( s_failureCount > 0 )
+    {
+        printf( "%d checks failed\n", s_failureCount );
+        return 1;
+    }
+    printf( "All checks passed\n" );
+    return 0;
+}